@@ -0,0 +1,54 @@
+/**
+ * Firmware that feeds the benchmark corpus (corpus.h) through the parser, for sim_bench.c
+ *
+ * Built for the ATtiny13A like main.c, with nmea.c built in the same way. Around each byte it
+ * writes markers to two timer registers that are otherwise unused here, which simavr reports
+ * to sim_bench.c with the cycle count: the parser's state before the byte to OCR0B, then the
+ * result to OCR0A. A pair of markers with nothing between them comes first so the cost of the
+ * markers themselves can be taken off.
+ */
+
+#include <avr/io.h>
+
+#include "../nmea.c"
+#include "corpus.h"
+
+// OCR0B markers that aren't parser states
+#define kMarkCalibrate 0xFD
+#define kMarkDone 0xFE
+
+// Passes over the corpus, so per-state figures include the parser meeting its own leftovers
+#define kPasses 4
+
+uint8_t uart_read_byte()
+{
+    return '\n';
+}
+
+int main(void)
+{
+    GpsParser parser = {0};
+    GpsTime output;
+
+    OCR0B = kMarkCalibrate;
+    __asm__ volatile("" ::: "memory");
+    OCR0A = 0;
+
+    for (uint8_t pass = 0; pass < kPasses; ++pass) {
+        for (uint16_t i = 0; i < kBenchCorpusLength; ++i) {
+            const char byte = kBenchCorpus[i];
+
+            OCR0B = parser.state;
+            __asm__ volatile("" ::: "memory");
+
+            const GpsReadStatus status = gps_parse_byte(&parser, &output, byte);
+
+            __asm__ volatile("" ::: "memory");
+            OCR0A = status;
+        }
+    }
+
+    OCR0B = kMarkDone;
+
+    for (;;) {}
+}
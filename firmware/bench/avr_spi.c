@@ -0,0 +1,48 @@
+/**
+ * Firmware that times spi_send_16() from main.c for sim_spi.c
+ *
+ * main.c is built in whole as it is for the clock, with its entry point renamed, so the routine
+ * timed is the one its features select (ENABLE_SPI_UNROLLED). Each call is marked like a byte
+ * in avr_bench.c: the index of the word to OCR0B before it and 0 to OCR0A after it.
+ */
+
+#include <avr/io.h>
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+// OCR0B markers that aren't word indexes, as in avr_bench.c
+#define kMarkCalibrate 0xFD
+#define kMarkDone 0xFE
+
+// The loop's cost depends on the bits set, so include the extremes and a mix of both
+static const __flash uint16_t words[] = {
+    0x0000, 0xFFFF, 0x5555, 0xAAAA, 0x00FF, 0xFF00, 0x0C3A, 0x0B07,
+};
+
+int main(void)
+{
+    OCR0B = kMarkCalibrate;
+    __asm__ volatile("" ::: "memory");
+    OCR0A = 0;
+
+    for (uint8_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+        uint16_t word = words[i];
+
+        // Load the word before the marker, and stop the call being specialised for its value
+        __asm__ volatile("" : "+r" (word));
+
+        OCR0B = i;
+        __asm__ volatile("" ::: "memory");
+
+        spi_send_16(word);
+
+        __asm__ volatile("" ::: "memory");
+        OCR0A = 0;
+    }
+
+    OCR0B = kMarkDone;
+
+    for (;;) {}
+}
@@ -0,0 +1,357 @@
+/**
+ * Time the NMEA sentence parser on the host over a fixed corpus (corpus.h)
+ *
+ * nmea.c is built in as main.c builds it, so the parser's helpers are inlined as they are on
+ * the AVR. After some warm-up samples, each sample times enough passes over the corpus to take
+ * a few tens of milliseconds. The results are written as JSON with every sample, and compared
+ * against a baseline from an earlier run with a Mann-Whitney U test, which doesn't assume the
+ * timings are normally distributed. The exit status is non-zero if the parser got
+ * significantly slower by more than a threshold.
+ *
+ * The timings are of this machine running host code, so they only compare two builds run here.
+ * They say nothing about time on the AVR, where avr_bench.c and sim_bench.c count cycles.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../nmea.c"
+#include "corpus.h"
+
+// Target length of each sample
+#define kSampleSeconds 0.02
+
+typedef struct Options {
+    uint32_t warmup;
+    uint32_t repetitions;
+    const char* outputPath;
+    const char* baselinePath;
+    double thresholdPercent; // Slowdown allowed before failing
+    double significance; // Largest p-value counted as a real change
+} Options;
+
+typedef struct Summary {
+    double median;
+    double mean;
+    double stddev;
+    double min;
+} Summary;
+
+/**
+ * Only gps_read_time() reads from the UART, and the benchmark calls gps_parse_byte()
+ */
+uint8_t uart_read_byte()
+{
+    return '\n';
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ * Feed the corpus through the parser a number of times, returning the successful decodes
+ */
+static uint32_t run_passes(uint32_t passes)
+{
+    GpsParser parser = {0};
+    GpsTime output;
+    uint32_t successes = 0;
+
+    for (uint32_t pass = 0; pass < passes; ++pass) {
+        for (size_t i = 0; i < kBenchCorpusLength; ++i) {
+            successes += gps_parse_byte(&parser, &output, kBenchCorpus[i]) == kGPS_Success;
+        }
+
+        // Keep the compiler from hoisting the parse out of the loop
+        __asm__ volatile("" : : "r"(&output) : "memory");
+    }
+
+    return successes;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+    const double da = *(const double*) a;
+    const double db = *(const double*) b;
+
+    return (da > db) - (da < db);
+}
+
+static Summary summarise(const double* samples, uint32_t count)
+{
+    double* sorted = malloc(count * sizeof(double));
+    memcpy(sorted, samples, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+
+    Summary summary = {
+        .median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2,
+        .min = sorted[0],
+    };
+
+    for (uint32_t i = 0; i < count; ++i) {
+        summary.mean += samples[i] / count;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        summary.stddev += (samples[i] - summary.mean) * (samples[i] - summary.mean);
+    }
+
+    summary.stddev = count > 1 ? sqrt(summary.stddev / (count - 1)) : 0;
+
+    free(sorted);
+    return summary;
+}
+
+static void write_summary(FILE* file, const char* name, const Summary* s, const double* samples, uint32_t count)
+{
+    fprintf(file, "  \"%s\": {\"median\": %.4f, \"mean\": %.4f, \"stddev\": %.4f, \"min\": %.4f",
+        name, s->median, s->mean, s->stddev, s->min);
+
+    if (samples != NULL) {
+        fprintf(file, ", \"samples\": [");
+
+        for (uint32_t i = 0; i < count; ++i) {
+            fprintf(file, "%s%.4f", i ? ", " : "", samples[i]);
+        }
+
+        fprintf(file, "]");
+    }
+
+    fprintf(file, "}");
+}
+
+/**
+ * Read the ns per byte samples back from a results file this wrote
+ *
+ * Returns the number of samples, or zero if the file couldn't be read.
+ */
+static uint32_t read_baseline(const char* path, double** samples)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return 0;
+    }
+
+    char text[1 << 16];
+    const size_t length = fread(text, 1, sizeof(text) - 1, file);
+    text[length] = '\0';
+    fclose(file);
+
+    const char* section = strstr(text, "\"ns_per_byte\"");
+    const char* list = section ? strstr(section, "\"samples\": [") : NULL;
+
+    if (list == NULL) {
+        return 0;
+    }
+
+    list = strchr(list, '[') + 1;
+
+    uint32_t count = 0;
+    *samples = NULL;
+
+    for (;;) {
+        char* end;
+        const double value = strtod(list, &end);
+
+        if (end == list) {
+            break;
+        }
+
+        *samples = realloc(*samples, (count + 1) * sizeof(double));
+        (*samples)[count++] = value;
+
+        list = end + strspn(end, ", ");
+    }
+
+    return count;
+}
+
+/**
+ * Two-sided p-value of the Mann-Whitney U test that two sets of samples come from the same
+ * distribution, using the normal approximation (good for ten or more samples each)
+ */
+static double mann_whitney_p(const double* a, uint32_t na, const double* b, uint32_t nb)
+{
+    // Rank a's samples among both sets, counting ties as half
+    double rankSum = 0;
+
+    for (uint32_t i = 0; i < na; ++i) {
+        double rank = 1;
+
+        for (uint32_t j = 0; j < na; ++j) {
+            rank += (a[j] < a[i]) + 0.5 * (j != i && a[j] == a[i]);
+        }
+
+        for (uint32_t j = 0; j < nb; ++j) {
+            rank += (b[j] < a[i]) + 0.5 * (b[j] == a[i]);
+        }
+
+        rankSum += rank;
+    }
+
+    const double u = rankSum - na * (na + 1) / 2.0;
+    const double mean = na * nb / 2.0;
+    const double sd = sqrt(na * nb * (na + nb + 1) / 12.0);
+
+    return sd > 0 ? erfc(fabs(u - mean) / sd / sqrt(2)) : 1;
+}
+
+/**
+ * Returns false if the parser is significantly slower than the baseline
+ */
+static bool compare_baseline(const Options* o, const double* samples, uint32_t count)
+{
+    double* baseline;
+    const uint32_t baselineCount = read_baseline(o->baselinePath, &baseline);
+
+    if (baselineCount == 0) {
+        fprintf(stderr, "Couldn't read samples from baseline %s\n", o->baselinePath);
+        return false;
+    }
+
+    const double before = summarise(baseline, baselineCount).median;
+    const double after = summarise(samples, count).median;
+    const double change = (after - before) / before * 100;
+    const double p = mann_whitney_p(samples, count, baseline, baselineCount);
+    const bool significant = p < o->significance;
+
+    printf("  Against %s: %.3f -> %.3f ns/byte (%+.1f%%, p=%.2g), %s\n",
+        o->baselinePath, before, after, change, p,
+        !significant ? "no significant change" : (change > 0 ? "slower" : "faster"));
+
+    free(baseline);
+    return !(significant && change > o->thresholdPercent);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [-w warmup] [-r repetitions] [-o results.json] [-b baseline.json] [-t percent] [-p p-value]\n"
+        "  -w  Samples to run and throw away first (default 3)\n"
+        "  -r  Samples to time (default 30)\n"
+        "  -o  Write the results as JSON\n"
+        "  -b  Compare against the results of an earlier run\n"
+        "  -t  Fail if significantly slower than the baseline by more than this (default 5%%)\n"
+        "  -p  Significance level for a change (default 0.01)\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    Options o = {
+        .warmup = 3,
+        .repetitions = 30,
+        .thresholdPercent = 5,
+        .significance = 0.01,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:r:o:b:t:p:h")) != -1) {
+        switch (opt) {
+            case 'w': o.warmup = strtoul(optarg, NULL, 10); break;
+            case 'r': o.repetitions = strtoul(optarg, NULL, 10); break;
+            case 'o': o.outputPath = optarg; break;
+            case 'b': o.baselinePath = optarg; break;
+            case 't': o.thresholdPercent = atof(optarg); break;
+            case 'p': o.significance = atof(optarg); break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (o.repetitions < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (run_passes(1) != kBenchCorpusSuccesses) {
+        fprintf(stderr, "The corpus decoded %u times instead of %u\n", run_passes(1), kBenchCorpusSuccesses);
+        return 1;
+    }
+
+    // Size the samples from a rough first timing, which also warms up the caches and clock
+    uint32_t passes = 1;
+    double elapsed = 0;
+
+    while (elapsed < kSampleSeconds / 10) {
+        passes *= 2;
+
+        const double start = now();
+        run_passes(passes);
+        elapsed = now() - start;
+    }
+
+    passes = passes * (kSampleSeconds / elapsed) + 1;
+
+    for (uint32_t i = 0; i < o.warmup; ++i) {
+        run_passes(passes);
+    }
+
+    double* perByte = malloc(o.repetitions * sizeof(double));
+    double* perSuccess = malloc(o.repetitions * sizeof(double));
+
+    for (uint32_t i = 0; i < o.repetitions; ++i) {
+        const double start = now();
+        const uint32_t successes = run_passes(passes);
+        const double ns = (now() - start) * 1e9;
+
+        perByte[i] = ns / ((double) passes * kBenchCorpusLength);
+        perSuccess[i] = ns / successes;
+    }
+
+    const Summary byteSummary = summarise(perByte, o.repetitions);
+    const Summary successSummary = summarise(perSuccess, o.repetitions);
+
+    printf("Parser on the host (relative only, not AVR time): %u samples of %u passes over %zu bytes\n",
+        o.repetitions, passes, kBenchCorpusLength);
+    printf("  ns/byte:    median %.3f, mean %.3f, stddev %.3f, min %.3f\n",
+        byteSummary.median, byteSummary.mean, byteSummary.stddev, byteSummary.min);
+    printf("  ns/success: median %.1f, mean %.1f, stddev %.1f, min %.1f\n",
+        successSummary.median, successSummary.mean, successSummary.stddev, successSummary.min);
+
+    if (o.outputPath != NULL) {
+        FILE* file = fopen(o.outputPath, "w");
+
+        if (file == NULL) {
+            perror(o.outputPath);
+            return 1;
+        }
+
+        fprintf(file, "{\n");
+        fprintf(file, "  \"timing\": \"host, relative only\",\n");
+        fprintf(file, "  \"corpus_bytes\": %zu,\n", kBenchCorpusLength);
+        fprintf(file, "  \"corpus_successes\": %u,\n", kBenchCorpusSuccesses);
+        fprintf(file, "  \"passes_per_sample\": %u,\n", passes);
+        fprintf(file, "  \"warmup\": %u,\n", o.warmup);
+        fprintf(file, "  \"repetitions\": %u,\n", o.repetitions);
+        write_summary(file, "ns_per_byte", &byteSummary, perByte, o.repetitions);
+        fprintf(file, ",\n");
+        write_summary(file, "ns_per_success", &successSummary, NULL, 0);
+        fprintf(file, "\n}\n");
+        fclose(file);
+    }
+
+    bool passed = true;
+
+    if (o.baselinePath != NULL) {
+        passed = compare_baseline(&o, perByte, o.repetitions);
+    }
+
+    free(perByte);
+    free(perSuccess);
+
+    return passed ? 0 : 1;
+}
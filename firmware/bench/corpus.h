@@ -0,0 +1,22 @@
+#pragma once
+
+// Fixed NMEA traffic for benchmarking the sentence parser on the host and in simavr
+//
+// Small enough to sit in the ATtiny13A's flash beside the parser. It covers every result
+// gps_parse_byte() can give: sentences that are skipped, decoded, without a time, with a bad
+// checksum and cut short. Changing it invalidates any stored baseline.
+
+#define kBenchCorpusSuccesses 2
+
+static const __flash char kBenchCorpus[] =
+    "$GPGGA,123519.00,5133.82,N,00042.24,W,1,08,0.9,545.4,M,46.9,M,,*77\r\n"
+    "$GPGSA,A,3,04,05,09,12,24,,,,,,,,2.5,1.3,2.1*39\r\n"
+    "$GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62\r\n"
+    "$GPGSV,3,1,11,03,03,111,00,04,15,270,00,06,01,010,00,13,06,292,00*74\r\n"
+    "$GPRMC,,V,,,,,,,,,,N*53\r\n"
+    "$GPRMC,220516,A,5133.82,N,00042.24,W,173.8,231.8,130694,004.2,W*14\r\n"
+    "$GPRMC,220516,A,5133.8"
+    "$GPRMC,220516,A,5133.82,N,00042.24,W,173.8,231.8,130694,004.2,W*70\r\n";
+
+// Without the null terminator
+#define kBenchCorpusLength (sizeof(kBenchCorpus) - 1)
@@ -0,0 +1,269 @@
+/**
+ * Count the AVR cycles the NMEA parser takes per byte in simavr, split by parser state
+ *
+ * Runs avr_bench.elf, which marks the start and end of each gps_parse_byte() call with writes
+ * to OCR0B and OCR0A (see avr_bench.c). Cycles are exact for the simulated core, so two builds
+ * can be compared directly: with a baseline from an earlier run, the exit status is non-zero if
+ * the cycles per byte went up by more than a threshold.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+
+// Marker registers in the ATtiny13A's data space (I/O address + 0x20)
+#define OCR0A_ADDR 0x56
+#define OCR0B_ADDR 0x49
+
+// OCR0B markers that aren't parser states, as in avr_bench.c
+#define kMarkCalibrate 0xFD
+#define kMarkDone 0xFE
+
+// Give up on firmware that never finishes
+#define kMaxCycles 100000000ULL
+
+// Parser states, in the order of NmeaReadState in nmea.c
+static const char* stateNames[] = {
+    "search_start",
+    "skip_sentence",
+    "read_type",
+    "read_fields",
+    "checksum_verify",
+};
+
+#define kNumStates (sizeof(stateNames) / sizeof(stateNames[0]))
+
+typedef struct StateCycles {
+    uint64_t bytes;
+    uint64_t cycles;
+    uint64_t max;
+} StateCycles;
+
+typedef struct Bench {
+    avr_t* avr;
+
+    uint8_t mark;
+    avr_cycle_count_t markCycle;
+    uint64_t overhead;
+    bool done;
+
+    StateCycles states[kNumStates];
+    uint64_t successes;
+} Bench;
+
+static void start_marked(avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+    Bench* bench = param;
+
+    bench->mark = value;
+    bench->markCycle = avr->cycle;
+    bench->done = value == kMarkDone;
+}
+
+static void end_marked(avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+    Bench* bench = param;
+    const uint64_t cycles = avr->cycle - bench->markCycle;
+
+    if (bench->mark == kMarkCalibrate) {
+        bench->overhead = cycles;
+        return;
+    }
+
+    if (bench->mark >= kNumStates) {
+        return;
+    }
+
+    StateCycles* state = &bench->states[bench->mark];
+    const uint64_t parse = cycles > bench->overhead ? cycles - bench->overhead : 0;
+
+    ++state->bytes;
+    state->cycles += parse;
+
+    if (parse > state->max) {
+        state->max = parse;
+    }
+
+    // kGPS_Success
+    if (value == 0) {
+        ++bench->successes;
+    }
+}
+
+static double per(uint64_t total, uint64_t count)
+{
+    return count ? (double) total / count : 0;
+}
+
+static void write_results(const Bench* bench, FILE* file, uint64_t bytes, uint64_t cycles)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"bytes\": %llu,\n", (unsigned long long) bytes);
+    fprintf(file, "  \"successes\": %llu,\n", (unsigned long long) bench->successes);
+    fprintf(file, "  \"cycles_per_byte\": %.2f,\n", per(cycles, bytes));
+    fprintf(file, "  \"cycles_per_success\": %.1f,\n", per(cycles, bench->successes));
+    fprintf(file, "  \"states\": {\n");
+
+    for (size_t s = 0; s < kNumStates; ++s) {
+        const StateCycles* state = &bench->states[s];
+
+        fprintf(file, "    \"%s\": {\"bytes\": %llu, \"cycles_per_byte\": %.2f, \"max_cycles\": %llu}%s\n",
+            stateNames[s], (unsigned long long) state->bytes, per(state->cycles, state->bytes),
+            (unsigned long long) state->max, s + 1 < kNumStates ? "," : "");
+    }
+
+    fprintf(file, "  }\n}\n");
+}
+
+/**
+ * Read the overall cycles per byte from a results file this wrote, or return a negative number
+ */
+static double read_baseline(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+
+    char text[4096];
+    const size_t length = fread(text, 1, sizeof(text) - 1, file);
+    text[length] = '\0';
+    fclose(file);
+
+    const char* field = strstr(text, "\"cycles_per_byte\": ");
+    return field ? atof(field + strlen("\"cycles_per_byte\": ")) : -1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [-m mcu] [-o results.json] [-b baseline.json] [-t percent] avr_bench.elf\n"
+        "  -m  simavr core name (default attiny13)\n"
+        "  -o  Write the results as JSON\n"
+        "  -b  Compare against the results of an earlier run\n"
+        "  -t  Fail if the cycles per byte went up by more than this (default 2%%)\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    const char* mcu = "attiny13";
+    const char* outputPath = NULL;
+    const char* baselinePath = NULL;
+    double thresholdPercent = 2;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:o:b:t:h")) != -1) {
+        switch (opt) {
+            case 'm': mcu = optarg; break;
+            case 'o': outputPath = optarg; break;
+            case 'b': baselinePath = optarg; break;
+            case 't': thresholdPercent = atof(optarg); break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    elf_firmware_t firmware = {0};
+    if (elf_read_firmware(argv[optind], &firmware) != 0) {
+        fprintf(stderr, "Failed to load %s\n", argv[optind]);
+        return 1;
+    }
+
+    Bench bench = { .mark = kMarkDone };
+
+    bench.avr = avr_make_mcu_by_name(mcu);
+    if (bench.avr == NULL) {
+        fprintf(stderr, "simavr doesn't know the %s core\n", mcu);
+        return 1;
+    }
+
+    avr_init(bench.avr);
+    firmware.frequency = 9600000;
+    avr_load_firmware(bench.avr, &firmware);
+
+    avr_register_io_write(bench.avr, OCR0B_ADDR, start_marked, &bench);
+    avr_register_io_write(bench.avr, OCR0A_ADDR, end_marked, &bench);
+
+    while (!bench.done && bench.avr->cycle < kMaxCycles) {
+        const int state = avr_run(bench.avr);
+
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "Firmware stopped at cycle %llu (state %d)\n",
+                (unsigned long long) bench.avr->cycle, state);
+            return 1;
+        }
+    }
+
+    if (!bench.done) {
+        fprintf(stderr, "Firmware didn't finish within %llu cycles\n", kMaxCycles);
+        return 1;
+    }
+
+    uint64_t bytes = 0;
+    uint64_t cycles = 0;
+
+    for (size_t s = 0; s < kNumStates; ++s) {
+        bytes += bench.states[s].bytes;
+        cycles += bench.states[s].cycles;
+    }
+
+    printf("Parser on the AVR: %llu bytes, %llu decoded, marker overhead %llu cycles\n",
+        (unsigned long long) bytes, (unsigned long long) bench.successes,
+        (unsigned long long) bench.overhead);
+    printf("  cycles/byte: %.2f, cycles/success: %.1f\n", per(cycles, bytes), per(cycles, bench.successes));
+
+    for (size_t s = 0; s < kNumStates; ++s) {
+        const StateCycles* state = &bench.states[s];
+
+        printf("    %-16s %8llu bytes  %7.2f cycles/byte  max %llu\n", stateNames[s],
+            (unsigned long long) state->bytes, per(state->cycles, state->bytes),
+            (unsigned long long) state->max);
+    }
+
+    if (outputPath != NULL) {
+        FILE* file = fopen(outputPath, "w");
+
+        if (file == NULL) {
+            perror(outputPath);
+            return 1;
+        }
+
+        write_results(&bench, file, bytes, cycles);
+        fclose(file);
+    }
+
+    if (baselinePath != NULL) {
+        const double before = read_baseline(baselinePath);
+        const double after = per(cycles, bytes);
+
+        if (before <= 0) {
+            fprintf(stderr, "Couldn't read cycles per byte from baseline %s\n", baselinePath);
+            return 1;
+        }
+
+        const double change = (after - before) / before * 100;
+        printf("  Against %s: %.2f -> %.2f cycles/byte (%+.1f%%)\n", baselinePath, before, after, change);
+
+        if (change > thresholdPercent) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * Count the AVR cycles spi_send_16() takes per word in simavr
+ *
+ * Runs a build of avr_spi.c, which marks each call with writes to OCR0B and OCR0A, and prints
+ * the fewest and most cycles a word took, less the cost of the markers. This includes the call
+ * and return where spi_send_16() isn't inlined. Used by `make spi-report` in the firmware.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+
+// Marker registers in the ATtiny13A's data space (I/O address + 0x20), as in sim_bench.c
+#define OCR0A_ADDR 0x56
+#define OCR0B_ADDR 0x49
+
+// OCR0B markers that aren't word indexes, as in avr_spi.c
+#define kMarkCalibrate 0xFD
+#define kMarkDone 0xFE
+
+// Give up on firmware that never finishes
+#define kMaxCycles 1000000ULL
+
+typedef struct Bench {
+    uint8_t mark;
+    avr_cycle_count_t markCycle;
+    uint64_t overhead;
+    bool done;
+
+    uint32_t words;
+    uint64_t min;
+    uint64_t max;
+} Bench;
+
+static void start_marked(avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+    Bench* bench = param;
+
+    bench->mark = value;
+    bench->markCycle = avr->cycle;
+    bench->done = value == kMarkDone;
+}
+
+static void end_marked(avr_t* avr, avr_io_addr_t addr, uint8_t value, void* param)
+{
+    Bench* bench = param;
+    const uint64_t cycles = avr->cycle - bench->markCycle;
+
+    if (bench->mark == kMarkCalibrate) {
+        bench->overhead = cycles;
+        return;
+    }
+
+    const uint64_t send = cycles > bench->overhead ? cycles - bench->overhead : 0;
+
+    if (bench->words == 0 || send < bench->min) {
+        bench->min = send;
+    }
+
+    if (send > bench->max) {
+        bench->max = send;
+    }
+
+    ++bench->words;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s avr_spi.elf\n", argv[0]);
+        return 1;
+    }
+
+    elf_firmware_t firmware = {0};
+    if (elf_read_firmware(argv[1], &firmware) != 0) {
+        fprintf(stderr, "Failed to load %s\n", argv[1]);
+        return 1;
+    }
+
+    Bench bench = { .mark = kMarkDone };
+
+    avr_t* avr = avr_make_mcu_by_name("attiny13");
+    if (avr == NULL) {
+        fprintf(stderr, "simavr doesn't know the attiny13 core\n");
+        return 1;
+    }
+
+    avr_init(avr);
+    firmware.frequency = 9600000;
+    avr_load_firmware(avr, &firmware);
+
+    avr_register_io_write(avr, OCR0B_ADDR, start_marked, &bench);
+    avr_register_io_write(avr, OCR0A_ADDR, end_marked, &bench);
+
+    while (!bench.done && avr->cycle < kMaxCycles) {
+        const int state = avr_run(avr);
+
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "Firmware stopped at cycle %llu (state %d)\n",
+                (unsigned long long) avr->cycle, state);
+            return 1;
+        }
+    }
+
+    if (!bench.done || bench.words == 0) {
+        fprintf(stderr, "Firmware didn't time any words within %llu cycles\n", kMaxCycles);
+        return 1;
+    }
+
+    // One line for the report: a range when the cost depends on the data
+    if (bench.min == bench.max) {
+        printf("%llu (fixed)\n", (unsigned long long) bench.min);
+    } else {
+        printf("%llu-%llu (data dependent)\n", (unsigned long long) bench.min, (unsigned long long) bench.max);
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Build options derived from the features enabled with FEATURES in the Makefile
+// This is shared by main.c and startup.S so both agree on what is compiled in
+
+// Features that timestamp events with the Timer0 overflow count
+// Sleeping relies on the overflow interrupt to wake up for the scheduler's timer tasks
+#if defined(ENABLE_TELEMETRY) || defined(ENABLE_HOLDOVER) || defined(ENABLE_PPS_STATS) \
+    || defined(ENABLE_SLEEP)
+#define ENABLE_TIMEBASE
+#endif
+
+// The vector table is only included when an interrupt is used, as it costs flash
+#if defined(ENABLE_TIMEBASE) || defined(ENABLE_PPS_INTERRUPT) || defined(ENABLE_ADC_SLEEP)
+#define USE_INTERRUPTS
+#endif
+
+// The latch relies on LOAD only being released to the timepulse while waiting for it
+#if defined(ENABLE_PPS_LATCH) && defined(ENABLE_PPS_INTERRUPT)
+#error "ENABLE_PPS_LATCH and ENABLE_PPS_INTERRUPT are alternatives and can't be used together"
+#endif
+
+// Timepulse edges are only timestamped accurately from the interrupt
+#if defined(ENABLE_PPS_STATS) && !defined(ENABLE_PPS_INTERRUPT)
+#error "ENABLE_PPS_STATS requires ENABLE_PPS_INTERRUPT"
+#endif
+
+// The polled timepulse reads PCIF, which the interrupt that wakes the CPU would clear
+#if defined(ENABLE_SLEEP) && !defined(ENABLE_PPS_INTERRUPT)
+#error "ENABLE_SLEEP requires ENABLE_PPS_INTERRUPT"
+#endif
+
+// Timer0 and ADC prescalers for each internal oscillator setting (the CKSEL and CKDIV8 fuses)
+// Slower clocks keep Timer0 overflowing at most every ~55ms, so fewer wake-ups from sleep,
+// and the ADC clock at 75kHz, inside its 50-200kHz range for full resolution
+#if F_CPU == 9600000
+#define TIMER0_PRESCALER 1024
+#define TIMER0_CLOCK_SELECT (_BV(CS02) | _BV(CS00))
+#define ADC_PRESCALE_SELECT (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))
+#elif F_CPU == 4800000
+#define TIMER0_PRESCALER 1024
+#define TIMER0_CLOCK_SELECT (_BV(CS02) | _BV(CS00))
+#define ADC_PRESCALE_SELECT (_BV(ADPS2) | _BV(ADPS1))
+#elif F_CPU == 1200000
+#define TIMER0_PRESCALER 256
+#define TIMER0_CLOCK_SELECT _BV(CS02)
+#define ADC_PRESCALE_SELECT _BV(ADPS2)
+#else
+#error "F_CPU must be one of the internal oscillator settings: 9600000, 4800000 or 1200000"
+#endif
@@ -0,0 +1,440 @@
+/**
+ * Measure how the receive chain copes with line faults: bit errors and baud rate mismatch
+ *
+ * Runs main() on the host backend (see ../host/hal_host.h) once for each pair of a bit error
+ * rate and a GPS baud rate skew, with traffic from the generator in ../host/nmea_gen.h. The
+ * soft UART samples the skewed bits at its own idea of the baud rate, so framing errors come
+ * from the real receive code. Each second the displayed time is checked just before the next
+ * timepulse. The table has, per hour of clock time: seconds shown correctly, seconds showing
+ * E1 (a checksum failure) and E2 (a bad format), and the mean and longest run of wrong seconds
+ * before the display recovered. The RMC column is the share of RMC sentences the generator
+ * sent intact, for comparison with what the clock made of them.
+ *
+ * Each cell runs in its own process, forked from one that has never run the firmware, so each
+ * starts from the firmware's power-up state.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+#include "nmea_gen.h"
+
+// Timepulses before the display is expected to be showing the right time
+#define kWarmupSeconds 3
+
+// How far ahead generated traffic is queued on the host, and how often
+#define kQueueAheadSeconds 0.5
+#define kQueueEverySeconds 0.25
+
+// Seconds from power-up to the start of the generated stream
+#define kPhaseSeconds 0.5
+
+// Most bit error rates or skews in a sweep
+#define kMaxRates 16
+
+// Checks queued ahead at once, which is at most a second's worth
+#define kMaxChecks 8
+
+typedef struct Options {
+    uint32_t jobs;
+    uint32_t seconds;
+    uint64_t seed;
+    double bitErrorRates[kMaxRates];
+    uint8_t numBitErrorRates;
+    double skewPercents[kMaxRates];
+    uint8_t numSkews;
+    const char* csvPath;
+} Options;
+
+/**
+ * Sent back to the parent process when a cell (a bit error rate and skew pair) finishes
+ */
+typedef struct CellResult {
+    uint32_t cell;
+    uint32_t secondsChecked;
+    uint32_t secondsCorrect;
+    uint32_t showingE1;
+    uint32_t showingE2;
+    uint32_t recoveries; // Runs of wrong seconds that ended with the right time
+    uint32_t recoverySeconds;
+    uint32_t longestRecovery;
+    uint32_t rmcSentences;
+    uint32_t rmcIntact;
+} CellResult;
+
+typedef struct Cell {
+    NmeaGen gen;
+    uint32_t queuedPulses;
+    uint32_t lastPulseUtc;
+
+    // UTC expected by each check_second() queued, in the order they run
+    uint32_t checkUtc[kMaxChecks];
+    uint32_t checkHead;
+    uint32_t checkTail;
+
+    uint32_t pulses; // Seconds checked or skipped so far
+    uint32_t wrongRun; // Wrong seconds in a row so far
+    CellResult result;
+} Cell;
+
+static uint64_t seconds_to_cycles(double seconds)
+{
+    return (uint64_t) llround((kPhaseSeconds + seconds) * F_CPU);
+}
+
+/**
+ * Check the display shows the second of the last timepulse, just before the next one
+ */
+static void check_second(void* param)
+{
+    Cell* cell = param;
+    CellResult* result = &cell->result;
+    const uint32_t utc = cell->checkUtc[cell->checkHead++ % kMaxChecks];
+
+    if (++cell->pulses <= kWarmupSeconds) {
+        return;
+    }
+
+    const uint8_t expected[6] = {
+        (utc / 3600) / 10, (utc / 3600) % 10,
+        ((utc / 60) % 60) / 10, ((utc / 60) % 60) % 10,
+        (utc % 60) / 10, (utc % 60) % 10,
+    };
+
+    const Max7219Model* display = hal_host_display();
+    uint8_t shown[6];
+
+    for (uint8_t i = 0; i < 6; ++i) {
+        shown[i] = max7219_model_digit(display, 0, i + 1);
+    }
+
+    ++result->secondsChecked;
+
+    if (memcmp(shown, expected, sizeof(shown)) == 0) {
+        ++result->secondsCorrect;
+
+        if (cell->wrongRun != 0) {
+            ++result->recoveries;
+            result->recoverySeconds += cell->wrongRun;
+
+            if (cell->wrongRun > result->longestRecovery) {
+                result->longestRecovery = cell->wrongRun;
+            }
+
+            cell->wrongRun = 0;
+        }
+
+        return;
+    }
+
+    ++cell->wrongRun;
+
+    if (shown[0] == 11 /* E */ && shown[1] == 1) {
+        ++result->showingE1;
+    } else if (shown[0] == 11 && shown[1] == 2) {
+        ++result->showingE2;
+    }
+}
+
+/**
+ * Hand the generator's bytes and timepulses to the host a little ahead of time
+ */
+static void queue_traffic(void* param)
+{
+    Cell* cell = param;
+    const double now = (double) hal_host_cycles() / F_CPU - kPhaseSeconds;
+
+    while (nmea_gen_peek(&cell->gen)->time < now + kQueueAheadSeconds) {
+        NmeaGenEvent event;
+        nmea_gen_next(&cell->gen, &event);
+
+        const uint64_t cycle = seconds_to_cycles(event.time);
+
+        switch (event.type) {
+            case kNmeaGen_Byte: {
+                const char byte = event.value;
+                hal_host_gps_send(cycle, &byte, 1);
+                break;
+            }
+
+            case kNmeaGen_PulseStart:
+                hal_host_timepulse(cycle, llround(cell->gen.config.ppsWidth * F_CPU));
+
+                // The second before this one is checked just before it
+                if (cell->queuedPulses++ != 0) {
+                    cell->checkUtc[cell->checkTail++ % kMaxChecks] = cell->lastPulseUtc;
+                    hal_host_at(cycle - llround(0.01 * F_CPU), check_second, cell);
+                }
+
+                cell->lastPulseUtc = event.utc;
+                break;
+
+            case kNmeaGen_PulseEnd:
+                break;
+        }
+    }
+
+    hal_host_at(hal_host_cycles() + llround(kQueueEverySeconds * F_CPU), queue_traffic, cell);
+}
+
+static void run_cell(const Options* o, uint32_t index, CellResult* result)
+{
+    static Cell cell;
+
+    const double bitErrorRate = o->bitErrorRates[index / o->numSkews];
+    const double skew = o->skewPercents[index % o->numSkews] / 100.0;
+    const uint32_t baud = lround(BAUD * (1.0 + skew));
+
+    cell = (Cell) {
+        .result = {.cell = index},
+    };
+
+    NmeaGenConfig config;
+    nmea_gen_default_config(&config);
+    config.seed = o->seed;
+    config.baud = baud;
+    config.bitErrorRate = bitErrorRate;
+    nmea_gen_init(&cell.gen, &config);
+
+    hal_host_reset(F_CPU, kNumChips);
+    hal_host_gps_set_baud(baud);
+    hal_host_eeprom()[EEPROM_TIMEZONE_ADDR] = 0;
+    hal_host_set_light(128);
+
+    hal_host_at(0, queue_traffic, &cell);
+    hal_host_stop_at(seconds_to_cycles(o->seconds));
+
+    firmware_main();
+
+    cell.result.rmcSentences = cell.gen.stats.rmcSentences;
+    cell.result.rmcIntact = cell.gen.stats.rmcIntact;
+    *result = cell.result;
+
+    nmea_gen_free(&cell.gen);
+}
+
+static double per_hour(uint32_t count, const CellResult* result)
+{
+    return result->secondsChecked == 0 ? 0 : 3600.0 * count / result->secondsChecked;
+}
+
+static void print_table(const Options* o, const CellResult* results, const bool* finished, FILE* csv)
+{
+    printf("%-8s %6s %7s %9s %8s %8s %9s %8s\n",
+        "BER", "Skew", "RMC ok", "Correct/h", "E1/h", "E2/h", "Recovery", "Longest");
+
+    if (csv != NULL) {
+        fprintf(csv, "ber,skew_percent,rmc_intact_percent,correct_per_hour,e1_per_hour,e2_per_hour,"
+            "mean_recovery_seconds,longest_recovery_seconds\n");
+    }
+
+    for (uint32_t i = 0; i < (uint32_t) o->numBitErrorRates * o->numSkews; ++i) {
+        const double ber = o->bitErrorRates[i / o->numSkews];
+        const double skew = o->skewPercents[i % o->numSkews];
+
+        if (!finished[i]) {
+            printf("%-8.1e %+5.1f%% %s\n", ber, skew, "crashed");
+
+            if (csv != NULL) {
+                fprintf(csv, "%g,%g,,,,,,\n", ber, skew);
+            }
+
+            continue;
+        }
+
+        const CellResult* r = &results[i];
+        const double intact = r->rmcSentences == 0 ? 0 : 100.0 * r->rmcIntact / r->rmcSentences;
+        const double recovery = r->recoveries == 0 ? 0 : (double) r->recoverySeconds / r->recoveries;
+
+        printf("%-8.1e %+5.1f%% %6.2f%% %9.1f %8.1f %8.1f %8.2fs %7us\n",
+            ber, skew, intact, per_hour(r->secondsCorrect, r), per_hour(r->showingE1, r),
+            per_hour(r->showingE2, r), recovery, r->longestRecovery);
+
+        if (csv != NULL) {
+            fprintf(csv, "%g,%g,%.2f,%.1f,%.1f,%.1f,%.2f,%u\n",
+                ber, skew, intact, per_hour(r->secondsCorrect, r), per_hour(r->showingE1, r),
+                per_hour(r->showingE2, r), recovery, r->longestRecovery);
+        }
+    }
+}
+
+/**
+ * Parse a comma separated list of numbers, returning how many were read or zero on an error
+ */
+static uint8_t parse_list(const char* text, double* values)
+{
+    uint8_t count = 0;
+
+    for (;;) {
+        char* end;
+        const double value = strtod(text, &end);
+
+        if (end == text || count == kMaxRates) {
+            return 0;
+        }
+
+        values[count++] = value;
+
+        if (*end == '\0') {
+            return count;
+        }
+
+        if (*end != ',') {
+            return 0;
+        }
+
+        text = end + 1;
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -e list    Bit error rates (default 0,1e-5,1e-4,3e-4,1e-3)\n"
+        "  -k list    GPS baud rate skews in %% (default -5,-3,-2,-1,0,1,2,3,5)\n"
+        "  -t secs    Seconds to run each pair for (default 3600)\n"
+        "  -s seed    Seed of the generated traffic (default 1)\n"
+        "  -j jobs    Pairs to run at once (default: one per CPU core)\n"
+        "  -c file    Also write the table as CSV\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    Options o = {
+        .jobs = sysconf(_SC_NPROCESSORS_ONLN),
+        .seconds = 3600,
+        .seed = 1,
+        .bitErrorRates = {0, 1e-5, 1e-4, 3e-4, 1e-3},
+        .numBitErrorRates = 5,
+        .skewPercents = {-5, -3, -2, -1, 0, 1, 2, 3, 5},
+        .numSkews = 9,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:k:t:s:j:c:h")) != -1) {
+        switch (opt) {
+            case 'e': o.numBitErrorRates = parse_list(optarg, o.bitErrorRates); break;
+            case 'k': o.numSkews = parse_list(optarg, o.skewPercents); break;
+            case 't': o.seconds = strtoul(optarg, NULL, 10); break;
+            case 's': o.seed = strtoull(optarg, NULL, 10); break;
+            case 'j': o.jobs = strtoul(optarg, NULL, 10); break;
+            case 'c': o.csvPath = optarg; break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc || o.numBitErrorRates == 0 || o.numSkews == 0 || o.jobs == 0
+        || o.seconds <= kWarmupSeconds) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* csv = NULL;
+    if (o.csvPath != NULL && (csv = fopen(o.csvPath, "w")) == NULL) {
+        perror(o.csvPath);
+        return 1;
+    }
+
+    // Each cell writes its result here as it finishes
+    int results[2];
+    if (pipe(results) != 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    const uint32_t numCells = (uint32_t) o.numBitErrorRates * o.numSkews;
+    CellResult* cells = calloc(numCells, sizeof(CellResult));
+    bool* finished = calloc(numCells, sizeof(bool));
+    uint32_t launched = 0;
+    uint32_t running = 0;
+    uint32_t crashed = 0;
+
+    while (launched < numCells || running != 0) {
+        if (launched < numCells && running < o.jobs) {
+            const pid_t pid = fork();
+
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+
+            if (pid == 0) {
+                CellResult result;
+                run_cell(&o, launched, &result);
+
+                const bool written = write(results[1], &result, sizeof(result)) == sizeof(result);
+                _exit(written ? 0 : 1);
+            }
+
+            ++launched;
+            ++running;
+            continue;
+        }
+
+        int status;
+        const pid_t pid = wait(&status);
+
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("wait");
+            return 1;
+        }
+
+        --running;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            // Written before the cell exited
+            CellResult result;
+            if (read(results[0], &result, sizeof(result)) == sizeof(result) && result.cell < numCells) {
+                cells[result.cell] = result;
+                finished[result.cell] = true;
+                continue;
+            }
+        }
+
+        ++crashed;
+    }
+
+    struct timespec finishedAt;
+    clock_gettime(CLOCK_MONOTONIC, &finishedAt);
+
+    const double elapsed = (finishedAt.tv_sec - started.tv_sec) + (finishedAt.tv_nsec - started.tv_nsec) / 1e9;
+
+    printf("Receive chain at %uHz and %u baud, %us per pair with seed %llu, in %.1fs with %u jobs\n",
+        (uint32_t) F_CPU, BAUD, o.seconds, (unsigned long long) o.seed, elapsed, o.jobs);
+    print_table(&o, cells, finished, csv);
+
+    if (csv != NULL) {
+        fclose(csv);
+    }
+
+    free(cells);
+    free(finished);
+
+    return crashed == 0 ? 0 : 1;
+}
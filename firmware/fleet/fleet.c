@@ -0,0 +1,750 @@
+/**
+ * Run a fleet of virtual clocks on the host build of the firmware, one process per clock
+ *
+ * Each clock runs main() on the host backend (see ../host/hal_host.h) with its own seed,
+ * which picks its oscillator error, the sentences its GPS sends and when, the phase of the
+ * timepulse against power-up, button presses and the light level over the run. Each second
+ * the displayed time is checked just before the next timepulse, and the cycles from the
+ * timepulse to the seconds digit being latched are collected into a histogram. The results
+ * from every clock are added up at the end. The exit status is non-zero if any clock showed
+ * a wrong second, missed a latch or crashed.
+ *
+ * Clocks are forked from a process that has never run the firmware, so each one starts from
+ * the firmware's power-up state. A clock can be run again on its own with -c 1 -s <seed>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+#include "random.h"
+
+// Digit register of the seconds ones on the first MAX7219
+#define kSecondsOnesDigit 6
+
+// Timepulses before the display is expected to be showing the right time
+#define kWarmupSeconds 3
+
+// Latency histogram buckets, the last one collecting everything longer
+#define kLatencyBucketUs 100
+#define kLatencyBuckets 32
+
+// Seeds of failing clocks listed in the report
+#define kMaxReportedSeeds 10
+
+// Sentences end by this far into the second, so slow baud rates send fewer optional ones, and
+// the bytes always kept free for the RMC sentence until it has been added
+#define kBurstEndMs 900
+#define kRmcLength 72
+
+// With -b, the longest the GPS keeps sending past a timepulse, kept under the shortest
+// sentence delay so the next second's sentences aren't pushed back
+#define kBusyOverrunMs 15
+
+// Shortest TXT sentence used to fill the line with -b: "$GPTXT,01,01,02,*XX\r\n"
+#define kFillerMinLength 21
+
+/**
+ * Typical ATtiny13A supply current at 5V, as in ../sim/sim_clock.c
+ */
+typedef struct SupplyCurrent {
+    uint32_t frequency;
+    double activeMa;
+    double idleMa;
+} SupplyCurrent;
+
+static const SupplyCurrent supplyCurrents[] = {
+    {9600000, 6.0, 2.0},
+    {4800000, 3.2, 1.0},
+    {1200000, 1.0, 0.3},
+};
+
+typedef struct Options {
+    uint32_t clocks;
+    uint32_t jobs;
+    uint32_t seconds;
+    uint64_t seed;
+    double oscillatorPercent; // Largest error of the internal oscillator either way
+    double jitterMs; // Largest change in the sentence delay from one second to the next
+    double pressesPerHour;
+    bool busy; // Keep the GPS sending across each timepulse
+    bool verbose;
+} Options;
+
+/**
+ * What a clock was given by its seed
+ */
+typedef struct ClockProfile {
+    double frequency; // Actual CPU clock, after the oscillator error
+    double oscillatorError;
+    double phase; // Seconds from power-up to the first timepulse
+    double sentenceDelayMs; // From the timepulse to the first sentence
+    uint8_t sentences; // Bit per optional sentence in kSentences
+    uint8_t rmcPosition; // Sentences sent before RMC
+    uint8_t gsvMessages;
+    bool multiGnss; // Talker ID of GN instead of GP on everything but RMC
+    uint32_t startTime; // Seconds since midnight of the first timepulse
+    int8_t timezone;
+    uint8_t light;
+} ClockProfile;
+
+/**
+ * Sent back to the parent process when a clock finishes
+ *
+ * This is kept under PIPE_BUF so each result is written in one piece.
+ */
+typedef struct ClockResult {
+    uint64_t seed;
+    double oscillatorError;
+    uint32_t secondsChecked;
+    uint32_t secondsWrong;
+    uint32_t showingE1;
+    uint32_t showingE2;
+    uint32_t missedLatches;
+    uint32_t buttonPresses;
+    uint32_t latencies[kLatencyBuckets];
+    uint32_t maxLatencyUs;
+    uint64_t cycles;
+    uint64_t sleepCycles;
+} ClockResult;
+
+typedef struct Clock {
+    const Options* options;
+    ClockProfile profile;
+    uint64_t random;
+
+    uint32_t second; // Timepulses so far
+    uint64_t pulseStart;
+    bool awaitingLatch;
+    bool buttonUsed; // The button was down at some point since the last timepulse
+    bool buttonDown;
+    bool buttonPending; // From a press being scheduled until the release
+    uint32_t releasedAt; // Second the button was last released in
+    double holdSeconds;
+
+    ClockResult result;
+} Clock;
+
+// Optional sentences that can be sent along with RMC
+enum {
+    kSentence_GGA,
+    kSentence_GSA,
+    kSentence_GSV,
+    kSentence_VTG,
+    kSentence_ZDA,
+    kNumSentences,
+};
+
+static uint64_t seconds_to_cycles(const Clock* clock, double seconds)
+{
+    return (uint64_t) llround(seconds * clock->profile.frequency);
+}
+
+static uint64_t pulse_cycle(const Clock* clock, uint32_t second)
+{
+    return seconds_to_cycles(clock, clock->profile.phase + second);
+}
+
+static void pick_profile(Clock* clock)
+{
+    const Options* o = clock->options;
+    ClockProfile* p = &clock->profile;
+    uint64_t* r = &clock->random;
+
+    p->oscillatorError = random_uniform(r, -o->oscillatorPercent, o->oscillatorPercent) / 100.0;
+    p->frequency = F_CPU * (1.0 + p->oscillatorError);
+    p->phase = random_uniform(r, 0.1, 1.1);
+    p->sentenceDelayMs = random_uniform(r, 20, 300);
+    p->sentences = random_below(r, 1 << kNumSentences);
+    p->rmcPosition = random_below(r, kNumSentences + 1);
+    p->gsvMessages = 1 + random_below(r, 3);
+    p->multiGnss = random_below(r, 2);
+    p->startTime = random_below(r, 86400);
+    p->timezone = (int8_t) random_below(r, 26) - 12;
+    p->light = 10 + random_below(r, 240);
+}
+
+static size_t append_sentence(char* buffer, size_t size, const char* sentence)
+{
+    uint8_t checksum = 0;
+
+    // Everything between the '$' and the '*'
+    for (const char* c = sentence + 1; *c != '\0'; ++c) {
+        checksum ^= *c;
+    }
+
+    const int length = snprintf(buffer, size, "%s*%02X\r\n", sentence, checksum);
+    return length < 0 || (size_t) length >= size ? 0 : length;
+}
+
+static size_t append_optional(Clock* clock, char* buffer, size_t size, uint8_t sentence,
+                              uint32_t hour, uint32_t minute, uint32_t second)
+{
+    // Only RMC is read, so the others can come from any talker
+    const char* talker = clock->profile.multiGnss ? "GN" : "GP";
+    char text[120];
+    size_t length = 0;
+
+    switch (sentence) {
+        case kSentence_GGA:
+            snprintf(text, sizeof(text), "$%sGGA,%02u%02u%02u.00,5133.82,N,00042.24,W,1,08,1.0,10.0,M,0.0,M,,",
+                talker, hour, minute, second);
+            return append_sentence(buffer, size, text);
+
+        case kSentence_GSA:
+            snprintf(text, sizeof(text), "$%sGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1", talker);
+            return append_sentence(buffer, size, text);
+
+        case kSentence_GSV:
+            for (uint8_t i = 1; i <= clock->profile.gsvMessages; ++i) {
+                snprintf(text, sizeof(text), "$GPGSV,%u,%u,%02u,%02u,40,083,46,%02u,17,308,41,%02u,07,344,39,%02u,22,228,45",
+                    clock->profile.gsvMessages, i, clock->profile.gsvMessages * 4, i * 4, i * 4 + 1, i * 4 + 2, i * 4 + 3);
+                length += append_sentence(buffer + length, size - length, text);
+            }
+            return length;
+
+        case kSentence_VTG:
+            snprintf(text, sizeof(text), "$%sVTG,054.7,T,034.4,M,005.5,N,010.2,K,A", talker);
+            return append_sentence(buffer, size, text);
+
+        case kSentence_ZDA:
+            snprintf(text, sizeof(text), "$%sZDA,%02u%02u%02u.00,04,02,2019,00,00", talker, hour, minute, second);
+            return append_sentence(buffer, size, text);
+    }
+
+    return 0;
+}
+
+/**
+ * Queue the sentences the GPS sends after a timepulse, describing the time it marked
+ *
+ * Optional sentences are left out when there isn't time to send them before kBurstEndMs.
+ * Returns the number of bytes queued.
+ */
+static size_t queue_sentences(Clock* clock, uint64_t start, double delayMs)
+{
+    const uint32_t time = (clock->profile.startTime + clock->second) % 86400;
+    const uint32_t hour = time / 3600;
+    const uint32_t minute = (time / 60) % 60;
+    const uint32_t second = time % 60;
+
+    char buffer[1024];
+    size_t length = 0;
+
+    const double room = (kBurstEndMs - delayMs) * BAUD / 10000;
+
+    for (uint8_t i = 0; i <= kNumSentences; ++i) {
+        if (i == clock->profile.rmcPosition) {
+            char rmc[100];
+            snprintf(rmc, sizeof(rmc), "$GPRMC,%02u%02u%02u.00,A,5133.82,N,00042.24,W,000.0,000.0,040219,,,A",
+                hour, minute, second);
+            length += append_sentence(buffer + length, sizeof(buffer) - length, rmc);
+        }
+
+        if (i < kNumSentences && (clock->profile.sentences & (1 << i))) {
+            const size_t added = append_optional(clock, buffer + length, sizeof(buffer) - length, i, hour, minute, second);
+            const size_t reserved = i < clock->profile.rmcPosition ? kRmcLength : 0;
+
+            if (length + added + reserved <= room) {
+                length += added;
+            }
+        }
+    }
+
+    hal_host_gps_send(start, buffer, length);
+    return length;
+}
+
+/**
+ * Queue TXT sentences to keep the line busy for a number of bytes, as a chatty GPS does
+ */
+static void queue_filler(size_t bytes)
+{
+    static const char padding[] = "PADDING PADDING PADDING PADDING PADDING PADDING PADDING";
+
+    while (bytes >= kFillerMinLength) {
+        // Split into sentences of up to 75 bytes, without leaving a remainder too short for one
+        size_t length = bytes;
+
+        if (length > 75) {
+            length = bytes - 75 < kFillerMinLength ? bytes - kFillerMinLength : 75;
+        }
+
+        char text[100];
+        char sentence[100];
+        snprintf(text, sizeof(text), "$GPTXT,01,01,02,%.*s", (int) (length - kFillerMinLength), padding);
+
+        const size_t written = append_sentence(sentence, sizeof(sentence), text);
+        hal_host_gps_send(hal_host_cycles(), sentence, written);
+        bytes -= written;
+    }
+}
+
+/**
+ * Check the display shows the time of the last timepulse, just before the next one
+ */
+static void check_second(void* param)
+{
+    Clock* clock = param;
+    ClockResult* result = &clock->result;
+
+    if (clock->awaitingLatch) {
+        ++result->missedLatches;
+        clock->awaitingLatch = false;
+    }
+
+    // The timezone shows instead of the time while the button steps it, and the sentence
+    // already read when it last stepped still has the old timezone for the second after
+    if (clock->second <= kWarmupSeconds || clock->buttonUsed || clock->second <= clock->releasedAt + 1) {
+        return;
+    }
+
+    const uint32_t utc = clock->profile.startTime + clock->second - 1;
+    const uint32_t local = (utc + 86400 + _timezoneOffset * 3600) % 86400;
+    const uint8_t expected[6] = {
+        (local / 3600) / 10, (local / 3600) % 10,
+        ((local / 60) % 60) / 10, ((local / 60) % 60) % 10,
+        (local % 60) / 10, (local % 60) % 10,
+    };
+
+    const Max7219Model* display = hal_host_display();
+    uint8_t shown[6];
+
+    for (uint8_t i = 0; i < 6; ++i) {
+        shown[i] = max7219_model_digit(display, 0, i + 1);
+    }
+
+    ++result->secondsChecked;
+
+    if (memcmp(shown, expected, sizeof(shown)) == 0) {
+        return;
+    }
+
+    ++result->secondsWrong;
+
+    if (shown[0] == 11 /* E */ && shown[1] == 1) {
+        ++result->showingE1;
+    } else if (shown[0] == 11 && shown[1] == 2) {
+        ++result->showingE2;
+    }
+
+    if (clock->options->verbose) {
+        fprintf(stderr, "Seed %llu, second %u: showing %02X%02X:%02X%02X:%02X%02X, expected %u%u:%u%u:%u%u\n",
+            (unsigned long long) result->seed, clock->second,
+            shown[0], shown[1], shown[2], shown[3], shown[4], shown[5],
+            expected[0], expected[1], expected[2], expected[3], expected[4], expected[5]);
+    }
+}
+
+/**
+ * Time the seconds digit of the new timepulse being latched
+ */
+static void display_latched(void* param)
+{
+    Clock* clock = param;
+
+    if (!clock->awaitingLatch) {
+        return;
+    }
+
+    const uint32_t utc = clock->profile.startTime + clock->second - 1;
+    const uint8_t expectedOnes = ((utc + 86400 + _timezoneOffset * 3600) % 86400) % 10;
+
+    if (max7219_model_digit(hal_host_display(), 0, kSecondsOnesDigit) != expectedOnes) {
+        return;
+    }
+
+    const double us = (hal_host_cycles() - clock->pulseStart) * 1e6 / clock->profile.frequency;
+    const uint32_t bucket = us / kLatencyBucketUs;
+
+    ++clock->result.latencies[bucket < kLatencyBuckets ? bucket : kLatencyBuckets - 1];
+
+    if (us > clock->result.maxLatencyUs) {
+        clock->result.maxLatencyUs = ceil(us);
+    }
+
+    clock->awaitingLatch = false;
+}
+
+static void release_button(void* param)
+{
+    Clock* clock = param;
+
+    hal_host_set_button(false);
+    clock->buttonDown = false;
+    clock->buttonPending = false;
+    clock->releasedAt = clock->second;
+}
+
+static void press_button(void* param)
+{
+    Clock* clock = param;
+
+    hal_host_set_button(true);
+    clock->buttonDown = true;
+    clock->buttonUsed = true;
+    ++clock->result.buttonPresses;
+
+    hal_host_at(hal_host_cycles() + seconds_to_cycles(clock, clock->holdSeconds), release_button, clock);
+}
+
+/**
+ * Start of each second: the timepulse, its sentences, the light level and maybe the button
+ */
+static void timepulse(void* param)
+{
+    Clock* clock = param;
+    const Options* o = clock->options;
+    uint64_t* r = &clock->random;
+
+    const uint64_t start = hal_host_cycles();
+    const double delayMs = clock->profile.sentenceDelayMs + random_uniform(r, 0, o->jitterMs);
+
+    hal_host_timepulse(start, seconds_to_cycles(clock, 0.1));
+    const size_t sent = queue_sentences(clock, start + seconds_to_cycles(clock, delayMs / 1000.0), delayMs);
+
+    if (o->busy) {
+        // Keep sending until just past the next timepulse, so it lands at any point in a byte
+        const double endMs = 1000 + random_uniform(r, 0, kBusyOverrunMs);
+        const double bytes = (endMs - delayMs) * BAUD / 10000.0 - sent;
+
+        queue_filler(bytes > 0 ? (size_t) bytes : 0);
+    }
+
+    ++clock->second;
+    clock->pulseStart = start;
+    clock->awaitingLatch = clock->second > kWarmupSeconds && !clock->buttonUsed && clock->second > clock->releasedAt + 1;
+    clock->buttonUsed = clock->buttonDown;
+
+    // The light drifts, with the occasional lamp switched on or off
+    if (random_below(r, 600) == 0) {
+        clock->profile.light = 10 + random_below(r, 240);
+    } else {
+        const int light = clock->profile.light + (int) random_below(r, 7) - 3;
+        clock->profile.light = light < 10 ? 10 : (light > 250 ? 250 : light);
+    }
+
+    hal_host_set_light(clock->profile.light);
+
+    // Presses from a tap up to holding the button through a few timezone steps
+    if (!clock->buttonPending && random_uniform(r, 0, 3600) < o->pressesPerHour) {
+        clock->buttonPending = true;
+        clock->holdSeconds = random_uniform(r, 0.05, 3.0);
+        hal_host_at(start + seconds_to_cycles(clock, random_uniform(r, 0, 0.9)), press_button, clock);
+    }
+
+    const uint64_t next = pulse_cycle(clock, clock->second);
+
+    hal_host_at(next - seconds_to_cycles(clock, 0.01), check_second, clock);
+    hal_host_at(next, timepulse, clock);
+}
+
+static void run_clock(const Options* o, uint64_t seed, ClockResult* result)
+{
+    static Clock clock;
+
+    clock = (Clock) {
+        .options = o,
+        .random = seed,
+        .result = {.seed = seed},
+    };
+
+    pick_profile(&clock);
+    clock.result.oscillatorError = clock.profile.oscillatorError;
+
+    hal_host_reset(llround(clock.profile.frequency), kNumChips);
+    hal_host_gps_set_baud(BAUD);
+    hal_host_eeprom()[EEPROM_TIMEZONE_ADDR] = clock.profile.timezone;
+    hal_host_set_light(clock.profile.light);
+    hal_host_on_latch(display_latched, &clock);
+
+    hal_host_at(pulse_cycle(&clock, 0), timepulse, &clock);
+    hal_host_stop_at(pulse_cycle(&clock, o->seconds));
+
+    firmware_main();
+
+    clock.result.cycles = hal_host_cycles();
+    clock.result.sleepCycles = hal_host_sleep_cycles();
+    *result = clock.result;
+}
+
+typedef struct Totals {
+    uint32_t clocks;
+    uint32_t crashed;
+    uint32_t failedClocks;
+    uint64_t failedSeeds[kMaxReportedSeeds];
+    uint64_t secondsChecked;
+    uint64_t secondsWrong;
+    uint64_t showingE1;
+    uint64_t showingE2;
+    uint64_t missedLatches;
+    uint64_t buttonPresses;
+    uint64_t latencies[kLatencyBuckets];
+    uint32_t maxLatencyUs;
+    double cycles;
+    double sleepCycles;
+    double worstFailingError; // Oscillator error of the failing clock furthest from nominal
+} Totals;
+
+static void add_failure(Totals* totals, uint64_t seed)
+{
+    if (totals->failedClocks < kMaxReportedSeeds) {
+        totals->failedSeeds[totals->failedClocks] = seed;
+    }
+
+    ++totals->failedClocks;
+}
+
+static void add_result(Totals* totals, const ClockResult* result)
+{
+    ++totals->clocks;
+    totals->secondsChecked += result->secondsChecked;
+    totals->secondsWrong += result->secondsWrong;
+    totals->showingE1 += result->showingE1;
+    totals->showingE2 += result->showingE2;
+    totals->missedLatches += result->missedLatches;
+    totals->buttonPresses += result->buttonPresses;
+    totals->cycles += result->cycles;
+    totals->sleepCycles += result->sleepCycles;
+
+    for (uint8_t i = 0; i < kLatencyBuckets; ++i) {
+        totals->latencies[i] += result->latencies[i];
+    }
+
+    if (result->maxLatencyUs > totals->maxLatencyUs) {
+        totals->maxLatencyUs = result->maxLatencyUs;
+    }
+
+    if (result->secondsWrong != 0 || result->missedLatches != 0) {
+        add_failure(totals, result->seed);
+
+        if (fabs(result->oscillatorError) > fabs(totals->worstFailingError)) {
+            totals->worstFailingError = result->oscillatorError;
+        }
+    }
+}
+
+static void print_report(const Options* o, const Totals* totals, double elapsed)
+{
+    const double clockSeconds = (double) totals->clocks * o->seconds;
+    const double perMillion = totals->secondsChecked == 0 ? 0 : 1e6 / totals->secondsChecked;
+
+    printf("Simulated %u clocks for %us each at %uHz ±%.1f%%, %u baud, in %.1fs with %u jobs\n",
+        totals->clocks, o->seconds, (uint32_t) F_CPU, o->oscillatorPercent, BAUD, elapsed, o->jobs);
+    printf("  %.0f clock seconds per second of real time\n", elapsed == 0 ? 0 : clockSeconds / elapsed);
+    printf("  Seconds checked: %llu, wrong: %llu (%.1f per million)\n",
+        (unsigned long long) totals->secondsChecked, (unsigned long long) totals->secondsWrong,
+        totals->secondsWrong * perMillion);
+    printf("  Showing E1: %llu (%.1f per million), E2: %llu (%.1f per million)\n",
+        (unsigned long long) totals->showingE1, totals->showingE1 * perMillion,
+        (unsigned long long) totals->showingE2, totals->showingE2 * perMillion);
+    printf("  Missed latches: %llu, button presses: %llu\n",
+        (unsigned long long) totals->missedLatches, (unsigned long long) totals->buttonPresses);
+    const double asleep = totals->cycles == 0 ? 0 : totals->sleepCycles / totals->cycles;
+    printf("  CPU asleep %.1f%% of the time", asleep * 100.0);
+
+    for (size_t i = 0; i < sizeof(supplyCurrents) / sizeof(supplyCurrents[0]); ++i) {
+        const SupplyCurrent* c = &supplyCurrents[i];
+
+        if (c->frequency == F_CPU) {
+            printf(", ~%.1fmA (datasheet typical at 5V)",
+                c->activeMa * (1.0 - asleep) + c->idleMa * asleep);
+        }
+    }
+
+    printf("\n");
+
+    uint64_t numLatencies = 0;
+    uint64_t mostInBucket = 0;
+
+    for (uint8_t i = 0; i < kLatencyBuckets; ++i) {
+        numLatencies += totals->latencies[i];
+
+        if (totals->latencies[i] > mostInBucket) {
+            mostInBucket = totals->latencies[i];
+        }
+    }
+
+    if (numLatencies != 0) {
+        printf("  Timepulse to seconds digit latched (max %uus):\n", totals->maxLatencyUs);
+
+        uint8_t last = kLatencyBuckets - 1;
+        while (last != 0 && totals->latencies[last] == 0) {
+            --last;
+        }
+
+        for (uint8_t i = 0; i <= last; ++i) {
+            const int bar = (int) ceil(40.0 * totals->latencies[i] / mostInBucket);
+
+            printf("    %s%5uus %10llu %.*s\n",
+                i == kLatencyBuckets - 1 ? ">=" : "< ",
+                (i + (i == kLatencyBuckets - 1 ? 0 : 1)) * kLatencyBucketUs,
+                (unsigned long long) totals->latencies[i],
+                totals->latencies[i] == 0 ? 0 : bar,
+                "########################################");
+        }
+    }
+
+    if (totals->crashed != 0) {
+        printf("  Clocks crashed: %u\n", totals->crashed);
+    }
+
+    if (totals->failedClocks != 0) {
+        printf("  Clocks with failures: %u (oscillator error up to %+.2f%%), seeds:",
+            totals->failedClocks, totals->worstFailingError * 100.0);
+
+        for (uint32_t i = 0; i < totals->failedClocks && i < kMaxReportedSeeds; ++i) {
+            printf(" %llu", (unsigned long long) totals->failedSeeds[i]);
+        }
+
+        printf("%s\n", totals->failedClocks > kMaxReportedSeeds ? " ..." : "");
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -c clocks  Virtual clocks to run (default 64)\n"
+        "  -j jobs    Clocks to run at once (default: one per CPU core)\n"
+        "  -t secs    Seconds to run each clock for (default 86400)\n"
+        "  -s seed    Seed of the first clock, the rest counting up from it (default 1)\n"
+        "  -o %%       Largest oscillator error either way (default 2)\n"
+        "  -J ms      Largest jitter on the delay before the sentences (default 5)\n"
+        "  -p rate    Button presses per hour (default 4)\n"
+        "  -b         Keep the GPS sending across each timepulse\n"
+        "  -v         Print each wrong second\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    Options o = {
+        .clocks = 64,
+        .jobs = sysconf(_SC_NPROCESSORS_ONLN),
+        .seconds = 86400,
+        .seed = 1,
+        .oscillatorPercent = 2,
+        .jitterMs = 5,
+        .pressesPerHour = 4,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:j:t:s:o:J:p:bvh")) != -1) {
+        switch (opt) {
+            case 'c': o.clocks = strtoul(optarg, NULL, 10); break;
+            case 'j': o.jobs = strtoul(optarg, NULL, 10); break;
+            case 't': o.seconds = strtoul(optarg, NULL, 10); break;
+            case 's': o.seed = strtoull(optarg, NULL, 10); break;
+            case 'o': o.oscillatorPercent = atof(optarg); break;
+            case 'J': o.jitterMs = atof(optarg); break;
+            case 'p': o.pressesPerHour = atof(optarg); break;
+            case 'b': o.busy = true; break;
+            case 'v': o.verbose = true; break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc || o.clocks == 0 || o.jobs == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Each clock writes its result here as it finishes
+    int results[2];
+    if (pipe(results) != 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    Totals totals = {0};
+    pid_t* pids = calloc(o.clocks, sizeof(pid_t));
+    uint32_t launched = 0;
+    uint32_t running = 0;
+
+    while (launched < o.clocks || running != 0) {
+        if (launched < o.clocks && running < o.jobs) {
+            const uint64_t seed = o.seed + launched;
+            const pid_t pid = fork();
+
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+
+            if (pid == 0) {
+                ClockResult result;
+                run_clock(&o, seed, &result);
+
+                const bool written = write(results[1], &result, sizeof(result)) == sizeof(result);
+                _exit(written ? 0 : 1);
+            }
+
+            pids[launched++] = pid;
+            ++running;
+            continue;
+        }
+
+        int status;
+        const pid_t pid = wait(&status);
+
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            perror("wait");
+            return 1;
+        }
+
+        --running;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            // Written before the clock exited
+            ClockResult result;
+            if (read(results[0], &result, sizeof(result)) == sizeof(result)) {
+                add_result(&totals, &result);
+                continue;
+            }
+        }
+
+        for (uint32_t i = 0; i < launched; ++i) {
+            if (pids[i] == pid) {
+                fprintf(stderr, "Clock with seed %llu crashed\n", (unsigned long long) (o.seed + i));
+                add_failure(&totals, o.seed + i);
+            }
+        }
+
+        ++totals.crashed;
+    }
+
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    const double elapsed = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    print_report(&o, &totals, elapsed);
+
+    free(pids);
+
+    const bool failed = totals.secondsWrong != 0 || totals.missedLatches != 0 || totals.crashed != 0;
+    return failed ? 1 : 0;
+}
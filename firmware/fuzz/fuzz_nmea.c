@@ -0,0 +1,230 @@
+/**
+ * Fuzzing harness for the NMEA parser's gps_read_time() (../nmea.c)
+ *
+ * Each input is fed to gps_read_time() through uart_read_byte() until it has all been read,
+ * with nulls after the end as from a line that's gone quiet. Every call is checked for:
+ *
+ *  - writes outside the GpsTime output, which sits between guard bytes that would catch any
+ *    index the 79 byte limit allows
+ *  - reading more than 79 bytes
+ *  - returning anything but a GpsReadStatus gps_read_time() can give
+ *
+ * A failed check aborts, so libFuzzer and AFL record the input as a crash. Built with
+ * -DFUZZ_STANDALONE, main() runs the inputs named on the command line (or stdin, for AFL) and
+ * can mutate them itself for a quick run without a fuzzing engine.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../nmea.c"
+
+// Guard bytes either side of the output, so any index below the length limit lands in them
+#define kGuardBytes NMEA_MAX_SENTENCE_LENGTH
+#define kGuardValue 0xA5
+
+typedef struct Guarded {
+    uint8_t before[kGuardBytes];
+    GpsTime time;
+    uint8_t after[kGuardBytes];
+} __attribute__((packed)) Guarded;
+
+static const uint8_t* g_input;
+static size_t g_inputSize;
+static size_t g_inputIndex;
+static uint32_t g_bytesRead;
+
+uint8_t uart_read_byte()
+{
+    ++g_bytesRead;
+    return g_inputIndex < g_inputSize ? g_input[g_inputIndex++] : '\0';
+}
+
+static void fail(const char* message, uint32_t value)
+{
+    fprintf(stderr, "%s (%u) at input byte %zu\n", message, value, g_inputIndex);
+    abort();
+}
+
+static bool guard_intact(const uint8_t* guard)
+{
+    for (size_t i = 0; i < kGuardBytes; ++i) {
+        if (guard[i] != kGuardValue) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    g_input = data;
+    g_inputSize = size;
+    g_inputIndex = 0;
+
+    while (g_inputIndex < g_inputSize) {
+        Guarded output;
+        memset(&output, kGuardValue, sizeof(output));
+        g_bytesRead = 0;
+
+        const GpsReadStatus status = gps_read_time(&output.time);
+
+        if (!guard_intact(output.before) || !guard_intact(output.after)) {
+            fail("Wrote outside the GpsTime output", sizeof(GpsTime));
+        }
+
+        if (g_bytesRead > NMEA_MAX_SENTENCE_LENGTH) {
+            fail("Read more than the sentence length limit", g_bytesRead);
+        }
+
+        if (status > kGPS_BadFormat) {
+            fail("Returned an invalid status", status);
+        }
+    }
+
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+// Largest input the standalone driver reads or builds
+#define kMaxInput 4096
+
+/**
+ * xorshift64, seeded from the command line so a failing run can be repeated
+ */
+static uint64_t g_random = 1;
+
+static uint32_t random_below(uint32_t limit)
+{
+    g_random ^= g_random << 13;
+    g_random ^= g_random >> 7;
+    g_random ^= g_random << 17;
+    return limit ? g_random % limit : 0;
+}
+
+/**
+ * Make a few random changes to an input: flipped bits, bytes replaced with characters that
+ * mean something to the parser, and bytes inserted, deleted or repeated
+ */
+static size_t mutate(uint8_t* data, size_t size)
+{
+    static const char interesting[] = "$*,.\r\n0123456789ABCDEFGPRMCV";
+    const uint32_t changes = 1 + random_below(4);
+
+    for (uint32_t i = 0; i < changes; ++i) {
+        const size_t at = random_below(size + 1);
+
+        switch (random_below(5)) {
+            case 0:
+                if (at < size) {
+                    data[at] ^= 1 << random_below(8);
+                }
+                break;
+
+            case 1:
+                if (at < size) {
+                    data[at] = interesting[random_below(sizeof(interesting) - 1)];
+                }
+                break;
+
+            case 2:
+                if (size < kMaxInput) {
+                    memmove(data + at + 1, data + at, size - at);
+                    data[at] = interesting[random_below(sizeof(interesting) - 1)];
+                    ++size;
+                }
+                break;
+
+            case 3:
+                if (at < size) {
+                    memmove(data + at, data + at + 1, size - at - 1);
+                    --size;
+                }
+                break;
+
+            case 4: {
+                // Repeat a run of bytes, which makes overlong fields
+                const size_t length = at < size ? 1 + random_below(size - at < 16 ? size - at : 16) : 0;
+                const size_t copies = 1 + random_below(8);
+
+                for (size_t c = 0; c < copies && size + length <= kMaxInput; ++c) {
+                    memmove(data + at + length, data + at, size - at);
+                    size += length;
+                }
+                break;
+            }
+        }
+    }
+
+    return size;
+}
+
+static size_t read_input(FILE* file, uint8_t* data)
+{
+    return fread(data, 1, kMaxInput, file);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t mutations = 0;
+    int first = 1;
+
+    // -m <count> [-s <seed>]: mutate the inputs this many times between them
+    while (first + 1 < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "-m") == 0) {
+            mutations = strtoul(argv[first + 1], NULL, 10);
+        } else if (strcmp(argv[first], "-s") == 0) {
+            g_random = strtoull(argv[first + 1], NULL, 10) | 1;
+        } else {
+            break;
+        }
+
+        first += 2;
+    }
+
+    static uint8_t seeds[64][kMaxInput];
+    size_t seedSizes[64];
+    int numSeeds = 0;
+
+    if (first == argc) {
+        seedSizes[numSeeds++] = read_input(stdin, seeds[0]);
+    }
+
+    for (int i = first; i < argc && numSeeds < 64; ++i) {
+        FILE* file = fopen(argv[i], "rb");
+
+        if (file == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+
+        seedSizes[numSeeds] = read_input(file, seeds[numSeeds]);
+        ++numSeeds;
+        fclose(file);
+    }
+
+    for (int i = 0; i < numSeeds; ++i) {
+        LLVMFuzzerTestOneInput(seeds[i], seedSizes[i]);
+    }
+
+    static uint8_t input[kMaxInput];
+
+    for (uint32_t m = 0; m < mutations && numSeeds != 0; ++m) {
+        const int seed = random_below(numSeeds);
+        memcpy(input, seeds[seed], seedSizes[seed]);
+
+        const size_t size = mutate(input, seedSizes[seed]);
+        LLVMFuzzerTestOneInput(input, size);
+    }
+
+    printf("%d inputs and %u mutations passed\n", numSeeds, mutations);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#pragma once
+
+// Thin hardware abstraction for main.c and softuart.c
+//
+// Every register access goes through these macros. On the AVR they expand to the plain
+// register expressions, so they compile to the same instructions as direct access. HAL_HOST
+// builds route them through the host backend in host/, which emulates the peripherals
+// against a virtual clock so the whole firmware can run natively (see host/hal_host.h).
+
+#ifdef HAL_HOST
+#include "host/hal_host.h"
+
+#ifdef ENABLE_SPI_UNROLLED
+#error "ENABLE_SPI_UNROLLED is AVR assembly and can't be built for the host"
+#endif
+
+#define REG_READ(reg) hal_host_read(kHalReg_##reg)
+#define REG_WRITE(reg, value) hal_host_write(kHalReg_##reg, (value))
+
+// Busy wait for a number of CPU cycles
+#define hal_delay_cycles(cycles) hal_host_delay(cycles)
+
+// False once the host backend has run for as long as it was asked to
+#define hal_running() hal_host_running()
+
+// The scheduler has nothing to do until the next event: skip ahead to it
+#define hal_idle() hal_host_idle()
+
+// Stamp the start and end of a scheduler task, so the host can time each one
+#define hal_task_start(task) hal_host_task_start(kHalTask_##task)
+#define hal_task_end(task) hal_host_task_end(kHalTask_##task)
+
+#else
+#define REG_READ(reg) (reg)
+#define REG_WRITE(reg, value) ((reg) = (value))
+
+#define hal_delay_cycles(cycles) __builtin_avr_delay_cycles(cycles)
+#define hal_running() true
+
+// Polling again straight away is all the busy-waiting scheduler can do
+#define hal_idle() ((void) 0)
+
+#define hal_task_start(task) ((void) 0)
+#define hal_task_end(task) ((void) 0)
+#endif
+
+// Read-modify-write, which compiles to sbi/cbi for the low I/O registers as |= and &= do
+#define REG_SET(reg, bits) REG_WRITE(reg, REG_READ(reg) | (bits))
+#define REG_CLEAR(reg, bits) REG_WRITE(reg, REG_READ(reg) & ~(bits))
@@ -0,0 +1,688 @@
+#include "hal_host.h"
+
+#include <avr/io.h>
+
+#include <math.h>
+#include <string.h>
+
+// Set in SREG while interrupts are enabled
+#define SREG_I 0x80
+
+// Cycles to enter and return from an interrupt handler
+#define kInterruptCycles 4
+
+// Cycles for the first conversion after the ADC is enabled, in ADC clocks
+#define kAdcConversionClocks 25
+
+#define kMaxEvents 32
+#define kMaxTimepulses 8
+#define kMaxGpsBytes 4096
+
+// The GPS sends at the baud rate the firmware is built for until told otherwise
+#ifndef BAUD
+#define BAUD 9600
+#endif
+
+// The firmware's interrupt handlers, if it defines them
+extern void PCINT0_vect(void) __attribute__((weak));
+extern void TIM0_OVF_vect(void) __attribute__((weak));
+extern void ADC_vect(void) __attribute__((weak));
+
+typedef struct ScriptEvent {
+    uint64_t cycle;
+    void (*event)(void* param);
+    void* param;
+} ScriptEvent;
+
+typedef struct Timepulse {
+    uint64_t start;
+    uint64_t end;
+} Timepulse;
+
+static struct {
+    uint32_t frequency;
+    uint64_t cycle;
+    uint64_t stopCycle;
+    uint64_t sleepCycles;
+
+    uint8_t regs[kHalReg_Count];
+    bool inInterrupt;
+    uint32_t interruptsTaken;
+    uint64_t interruptCycles;
+
+    // Task stamps: where each task started, in the main loop and in an interrupt that ran
+    // during it, and the longest each has taken
+    uint64_t taskStart[2][kHalTask_Count];
+    uint64_t taskInterruptStart[2][kHalTask_Count];
+    uint64_t taskMax[kHalTask_Count];
+
+    // Timer0 counts from timerBaseCount at timerBase with the current prescaler
+    uint64_t timerBase;
+    uint64_t timerBaseCount;
+    uint64_t timerOverflows;
+
+    // Pin levels at the last update, to find edges
+    uint8_t lastPins;
+
+    // Pin levels the firmware last read from PINB, and the flags from GIFR and TIFR0
+    uint8_t polledPins;
+    uint8_t polledGifr;
+    uint8_t polledTifr0;
+
+    // GPS transmitter: each queued byte has the cycle its start bit begins
+    char gpsBytes[kMaxGpsBytes];
+    uint64_t gpsByteStart[kMaxGpsBytes];
+    size_t gpsLength;
+    size_t gpsHead;
+    uint64_t gpsEnd;
+    double cyclesPerBit;
+
+    Timepulse timepulses[kMaxTimepulses];
+    uint8_t numTimepulses;
+
+    // ADC
+    uint8_t light;
+    bool buttonPressed;
+    bool adcConverting;
+    uint64_t adcDone;
+
+    // EEPROM
+    uint8_t eeprom[HAL_HOST_EEPROM_SIZE];
+    bool eepromWriting;
+    uint64_t eepromDone;
+    uint8_t eepromAddress;
+    uint8_t eepromData;
+    uint32_t eepromWrites;
+
+    ScriptEvent events[kMaxEvents];
+    uint8_t numEvents;
+
+    Max7219Model display;
+    void (*latched)(void* param);
+    void* latchedParam;
+} g;
+
+static void update(void);
+
+static uint64_t bit_cycle(uint64_t start, double bit)
+{
+    return start + (uint64_t) llround(bit * g.cyclesPerBit);
+}
+
+static uint32_t timer_prescaler(void)
+{
+    static const uint16_t prescalers[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+    return prescalers[g.regs[kHalReg_TCCR0B] & 0x07];
+}
+
+static uint64_t timer_count(void)
+{
+    const uint32_t prescaler = timer_prescaler();
+
+    if (prescaler == 0) {
+        return g.timerBaseCount;
+    }
+
+    return g.timerBaseCount + (g.cycle - g.timerBase) / prescaler;
+}
+
+static void timer_rebase(void)
+{
+    g.timerBaseCount = timer_count();
+    g.timerBase = g.cycle;
+}
+
+static uint64_t timer_next_overflow(void)
+{
+    const uint32_t prescaler = timer_prescaler();
+
+    if (prescaler == 0) {
+        return UINT64_MAX;
+    }
+
+    const uint64_t nextOverflowCount = ((timer_count() >> 8) + 1) << 8;
+    return g.timerBase + (nextOverflowCount - g.timerBaseCount) * prescaler;
+}
+
+static uint8_t adc_reading(void)
+{
+    return g.buttonPressed ? 0 : g.light;
+}
+
+static uint32_t adc_prescaler(void)
+{
+    const uint8_t select = g.regs[kHalReg_ADCSRA] & 0x07;
+    return select == 0 ? 2 : (1 << select);
+}
+
+static bool gps_level(void)
+{
+    // Drop bytes that have been sent
+    while (g.gpsHead < g.gpsLength && g.cycle >= bit_cycle(g.gpsByteStart[g.gpsHead], 10)) {
+        ++g.gpsHead;
+    }
+
+    if (g.gpsHead == g.gpsLength || g.cycle < g.gpsByteStart[g.gpsHead]) {
+        return true;
+    }
+
+    const uint64_t start = g.gpsByteStart[g.gpsHead];
+    const uint8_t bit = (g.cycle - start) / g.cyclesPerBit;
+
+    if (bit == 0) {
+        return false;
+    }
+
+    if (bit >= 9) {
+        return true;
+    }
+
+    return (g.gpsBytes[g.gpsHead] >> (bit - 1)) & 1;
+}
+
+static uint64_t gps_next_edge(void)
+{
+    if (g.gpsHead == g.gpsLength) {
+        return UINT64_MAX;
+    }
+
+    const uint64_t start = g.gpsByteStart[g.gpsHead];
+
+    if (g.cycle < start) {
+        return start;
+    }
+
+    const uint64_t bit = (g.cycle - start) / g.cyclesPerBit;
+    return bit_cycle(start, bit + 1);
+}
+
+static bool load_level(void)
+{
+    for (uint8_t i = 0; i < g.numTimepulses; ++i) {
+        if (g.cycle >= g.timepulses[i].start && g.cycle < g.timepulses[i].end) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Levels on port B: driven by the firmware where the pin is an output, otherwise the outside world
+ */
+static uint8_t pin_levels(void)
+{
+    const uint8_t ddr = g.regs[kHalReg_DDRB];
+    const uint8_t external = (gps_level() ? _BV(PB1) : 0) | (load_level() ? _BV(PB3) : 0) | _BV(PB5);
+
+    return (g.regs[kHalReg_PORTB] & ddr) | (external & ~ddr);
+}
+
+static void run_interrupt(void (*vector)(void))
+{
+    ++g.interruptsTaken;
+
+    if (vector == NULL) {
+        return;
+    }
+
+    const uint64_t start = g.cycle;
+
+    g.inInterrupt = true;
+    g.regs[kHalReg_SREG] &= ~SREG_I;
+    g.cycle += kInterruptCycles;
+
+    vector();
+
+    g.cycle += kInterruptCycles;
+    g.regs[kHalReg_SREG] |= SREG_I;
+    g.inInterrupt = false;
+
+    g.interruptCycles += g.cycle - start;
+}
+
+/**
+ * Call the handler for each pending interrupt in vector order, clearing its flag
+ */
+static void dispatch_interrupts(void)
+{
+    uint8_t* regs = g.regs;
+
+    while (!g.inInterrupt && (regs[kHalReg_SREG] & SREG_I)) {
+        if ((regs[kHalReg_GIMSK] & _BV(PCIE)) && (regs[kHalReg_GIFR] & _BV(PCIF))) {
+            regs[kHalReg_GIFR] &= ~_BV(PCIF);
+            run_interrupt(PCINT0_vect);
+        } else if ((regs[kHalReg_TIMSK0] & _BV(TOIE0)) && (regs[kHalReg_TIFR0] & _BV(TOV0))) {
+            regs[kHalReg_TIFR0] &= ~_BV(TOV0);
+            run_interrupt(TIM0_OVF_vect);
+        } else if ((regs[kHalReg_ADCSRA] & _BV(ADIE)) && (regs[kHalReg_ADCSRA] & _BV(ADIF))) {
+            regs[kHalReg_ADCSRA] &= ~_BV(ADIF);
+            run_interrupt(ADC_vect);
+        } else {
+            break;
+        }
+    }
+}
+
+/**
+ * Bring the peripherals up to the current cycle
+ */
+static void update(void)
+{
+    uint8_t* regs = g.regs;
+
+    while (g.numEvents != 0 && g.events[0].cycle <= g.cycle) {
+        const ScriptEvent event = g.events[0];
+
+        --g.numEvents;
+        memmove(&g.events[0], &g.events[1], g.numEvents * sizeof(ScriptEvent));
+
+        event.event(event.param);
+    }
+
+    const uint64_t overflows = timer_count() >> 8;
+    if (overflows != g.timerOverflows) {
+        g.timerOverflows = overflows;
+        regs[kHalReg_TIFR0] |= _BV(TOV0);
+    }
+
+    if (g.adcConverting && g.cycle >= g.adcDone) {
+        g.adcConverting = false;
+        regs[kHalReg_ADCH] = adc_reading();
+        regs[kHalReg_ADCSRA] = (regs[kHalReg_ADCSRA] & ~_BV(ADSC)) | _BV(ADIF);
+    }
+
+    if (g.eepromWriting && g.cycle >= g.eepromDone) {
+        g.eepromWriting = false;
+        g.eeprom[g.eepromAddress] = g.eepromData;
+        ++g.eepromWrites;
+        regs[kHalReg_EECR] &= ~_BV(EEPE);
+    }
+
+    const uint8_t pins = pin_levels();
+    const uint8_t changed = pins ^ g.lastPins;
+
+    if (changed & regs[kHalReg_PCMSK]) {
+        regs[kHalReg_GIFR] |= _BV(PCIF);
+    }
+
+    // INT0 flags falling edges with ISC01 set and ISC00 clear
+    const bool rxFell = (changed & g.lastPins & _BV(PB1)) != 0;
+    if (rxFell && (regs[kHalReg_MCUCR] & (_BV(ISC01) | _BV(ISC00))) == _BV(ISC01)) {
+        regs[kHalReg_GIFR] |= _BV(INTF0);
+    }
+
+    g.lastPins = pins;
+
+    const bool latched = max7219_model_update(&g.display,
+        (pins & _BV(PB0)) != 0,
+        (pins & _BV(PB2)) != 0,
+        (pins & _BV(PB3)) != 0
+    );
+
+    if (latched && g.latched != NULL) {
+        g.latched(g.latchedParam);
+    }
+
+    // Forget timepulses that have finished
+    for (uint8_t i = 0; i < g.numTimepulses;) {
+        if (g.timepulses[i].end <= g.cycle) {
+            g.timepulses[i] = g.timepulses[--g.numTimepulses];
+        } else {
+            ++i;
+        }
+    }
+
+    dispatch_interrupts();
+}
+
+static void advance(uint32_t cycles)
+{
+    g.cycle += cycles;
+    update();
+}
+
+uint8_t hal_host_read(HalRegister reg)
+{
+    advance(HAL_HOST_ACCESS_CYCLES);
+
+    switch (reg) {
+        case kHalReg_PINB:
+            g.polledPins = pin_levels();
+            return g.polledPins;
+
+        case kHalReg_GIFR:
+            g.polledGifr = g.regs[reg];
+            return g.polledGifr;
+
+        case kHalReg_TIFR0:
+            g.polledTifr0 = g.regs[reg];
+            return g.polledTifr0;
+
+        case kHalReg_TCNT0:
+            return timer_count() & 0xFF;
+
+        case kHalReg_ADCH:
+            // Free-running conversions always have a recent reading
+            if ((g.regs[kHalReg_ADCSRA] & (_BV(ADEN) | _BV(ADATE))) == (_BV(ADEN) | _BV(ADATE))) {
+                return adc_reading();
+            }
+
+            return g.regs[kHalReg_ADCH];
+
+        default:
+            return g.regs[reg];
+    }
+}
+
+void hal_host_write(HalRegister reg, uint8_t value)
+{
+    uint8_t* regs = g.regs;
+
+    advance(HAL_HOST_ACCESS_CYCLES);
+
+    switch (reg) {
+        case kHalReg_GIFR:
+        case kHalReg_TIFR0:
+            // Flags are cleared by writing a one
+            regs[reg] &= ~value;
+            break;
+
+        case kHalReg_PINB:
+            // Writing a one toggles the port bit
+            regs[kHalReg_PORTB] ^= value;
+            break;
+
+        case kHalReg_TCCR0B:
+            timer_rebase();
+            regs[reg] = value;
+            break;
+
+        case kHalReg_TCNT0:
+            g.timerBaseCount = (timer_count() & ~0xFFULL) | value;
+            g.timerBase = g.cycle;
+            break;
+
+        case kHalReg_ADCSRA: {
+            const uint8_t flag = regs[reg] & _BV(ADIF) & ~value;
+            regs[reg] = (value & ~_BV(ADIF)) | flag;
+
+            if ((value & _BV(ADEN)) == 0) {
+                g.adcConverting = false;
+                regs[reg] &= ~_BV(ADSC);
+            } else if ((value & _BV(ADSC)) && (value & _BV(ADATE)) == 0 && !g.adcConverting) {
+                g.adcConverting = true;
+                g.adcDone = g.cycle + kAdcConversionClocks * adc_prescaler();
+            }
+            break;
+        }
+
+        case kHalReg_EECR:
+            if (value & _BV(EERE)) {
+                regs[kHalReg_EEDR] = g.eeprom[regs[kHalReg_EEARL] % HAL_HOST_EEPROM_SIZE];
+                value &= ~_BV(EERE);
+            }
+
+            // A write only starts if EEMPE was set first
+            if ((value & _BV(EEPE)) && (regs[reg] & _BV(EEMPE)) && !g.eepromWriting) {
+                g.eepromWriting = true;
+                g.eepromDone = g.cycle + (uint64_t) g.frequency * 34 / 10000; // 3.4ms
+                g.eepromAddress = regs[kHalReg_EEARL] % HAL_HOST_EEPROM_SIZE;
+                g.eepromData = regs[kHalReg_EEDR];
+                value &= ~_BV(EEMPE);
+            }
+
+            regs[reg] = (value & ~_BV(EEPE)) | (g.eepromWriting ? _BV(EEPE) : 0);
+            break;
+
+        default:
+            regs[reg] = value;
+            break;
+    }
+
+    // Let the outside world see the new outputs straight away
+    update();
+}
+
+void hal_host_delay(uint32_t cycles)
+{
+    advance(cycles);
+}
+
+/**
+ * Skip ahead to the next time something can happen
+ */
+static uint64_t next_event(void)
+{
+    uint64_t next = timer_next_overflow();
+
+    const uint64_t gpsEdge = gps_next_edge();
+    if (gpsEdge < next) {
+        next = gpsEdge;
+    }
+
+    for (uint8_t i = 0; i < g.numTimepulses; ++i) {
+        const uint64_t edge = g.cycle < g.timepulses[i].start ? g.timepulses[i].start : g.timepulses[i].end;
+
+        if (edge < next) {
+            next = edge;
+        }
+    }
+
+    if (g.adcConverting && g.adcDone < next) {
+        next = g.adcDone;
+    }
+
+    if (g.eepromWriting && g.eepromDone < next) {
+        next = g.eepromDone;
+    }
+
+    if (g.numEvents != 0 && g.events[0].cycle < next) {
+        next = g.events[0].cycle;
+    }
+
+    if (next > g.stopCycle) {
+        next = g.stopCycle;
+    }
+
+    return next > g.cycle ? next : g.cycle + 1;
+}
+
+void hal_host_sleep(void)
+{
+    if ((g.regs[kHalReg_MCUCR] & _BV(SE)) == 0) {
+        return;
+    }
+
+    // Sleep until an interrupt has run, which may already be pending
+    // Catch up with any pin change since the last register access first: the chip would have
+    // flagged it, and the next event is only looked for after it
+    const uint32_t interruptsTaken = g.interruptsTaken;
+    update();
+
+    while (g.interruptsTaken == interruptsTaken && g.cycle < g.stopCycle) {
+        const uint64_t next = next_event();
+
+        g.sleepCycles += next - g.cycle;
+        g.cycle = next;
+        update();
+    }
+}
+
+void hal_host_idle(void)
+{
+    // A pin can change or a flag be set between the firmware's poll and its call here, and the
+    // chip would see that on its next poll: let it poll once more rather than skip past it
+    const uint8_t pins = pin_levels();
+    const uint8_t gifr = g.regs[kHalReg_GIFR];
+    const uint8_t tifr0 = g.regs[kHalReg_TIFR0];
+
+    if (pins != g.polledPins || (gifr & ~g.polledGifr) != 0 || (tifr0 & ~g.polledTifr0) != 0) {
+        g.polledPins = pins;
+        g.polledGifr = gifr;
+        g.polledTifr0 = tifr0;
+        return;
+    }
+
+    // Polling again can't find anything new before the next event, so skip the polls
+    g.cycle = next_event();
+    update();
+}
+
+void hal_host_sei(void)
+{
+    // As on the chip, pending interrupts wait until after the next instruction
+    g.regs[kHalReg_SREG] |= SREG_I;
+    g.cycle += 1;
+}
+
+void hal_host_cli(void)
+{
+    g.regs[kHalReg_SREG] &= ~SREG_I;
+    g.cycle += 1;
+}
+
+bool hal_host_running(void)
+{
+    return g.cycle < g.stopCycle;
+}
+
+void hal_host_task_start(HalTask task)
+{
+    g.taskStart[g.inInterrupt][task] = g.cycle;
+    g.taskInterruptStart[g.inInterrupt][task] = g.interruptCycles;
+}
+
+void hal_host_task_end(HalTask task)
+{
+    // Leave out interrupts that ran during the task, which only the main loop can have
+    uint64_t cycles = g.cycle - g.taskStart[g.inInterrupt][task];
+    cycles -= g.interruptCycles - g.taskInterruptStart[g.inInterrupt][task];
+
+    if (cycles > g.taskMax[task]) {
+        g.taskMax[task] = cycles;
+    }
+}
+
+void hal_host_reset(uint32_t frequency, uint8_t numChips)
+{
+    memset(&g, 0, sizeof(g));
+
+    g.frequency = frequency;
+    g.stopCycle = UINT64_MAX;
+    g.cyclesPerBit = (double) frequency / BAUD;
+    g.light = 100;
+
+    memset(g.eeprom, 0xFF, sizeof(g.eeprom));
+    max7219_model_init(&g.display, numChips);
+
+    g.lastPins = pin_levels();
+}
+
+uint64_t hal_host_cycles(void)
+{
+    return g.cycle;
+}
+
+void hal_host_stop_at(uint64_t cycle)
+{
+    g.stopCycle = cycle;
+}
+
+void hal_host_at(uint64_t cycle, void (*event)(void* param), void* param)
+{
+    if (g.numEvents == kMaxEvents) {
+        return;
+    }
+
+    // Keep the events in time order
+    uint8_t i = g.numEvents;
+    while (i != 0 && g.events[i - 1].cycle > cycle) {
+        g.events[i] = g.events[i - 1];
+        --i;
+    }
+
+    g.events[i] = (ScriptEvent) {cycle, event, param};
+    ++g.numEvents;
+}
+
+void hal_host_gps_send(uint64_t cycle, const char* bytes, size_t length)
+{
+    // Make room by dropping bytes that have been sent, so a long stream can be queued a
+    // little at a time
+    if (g.gpsHead != 0) {
+        const size_t remaining = g.gpsLength - g.gpsHead;
+
+        memmove(g.gpsBytes, g.gpsBytes + g.gpsHead, remaining);
+        memmove(g.gpsByteStart, g.gpsByteStart + g.gpsHead, remaining * sizeof(g.gpsByteStart[0]));
+        g.gpsLength = remaining;
+        g.gpsHead = 0;
+    }
+
+    uint64_t start = cycle > g.gpsEnd ? cycle : g.gpsEnd;
+
+    for (size_t i = 0; i < length && g.gpsLength < kMaxGpsBytes; ++i) {
+        g.gpsBytes[g.gpsLength] = bytes[i];
+        g.gpsByteStart[g.gpsLength] = start;
+        ++g.gpsLength;
+
+        start = bit_cycle(start, 10);
+    }
+
+    g.gpsEnd = start;
+}
+
+void hal_host_gps_set_baud(uint32_t baud)
+{
+    g.cyclesPerBit = (double) g.frequency / baud;
+}
+
+void hal_host_timepulse(uint64_t cycle, uint32_t widthCycles)
+{
+    if (g.numTimepulses == kMaxTimepulses) {
+        return;
+    }
+
+    g.timepulses[g.numTimepulses++] = (Timepulse) {cycle, cycle + widthCycles};
+}
+
+void hal_host_set_light(uint8_t reading)
+{
+    g.light = reading;
+}
+
+void hal_host_set_button(bool pressed)
+{
+    g.buttonPressed = pressed;
+}
+
+uint8_t* hal_host_eeprom(void)
+{
+    return g.eeprom;
+}
+
+uint32_t hal_host_eeprom_writes(void)
+{
+    return g.eepromWrites;
+}
+
+uint64_t hal_host_sleep_cycles(void)
+{
+    return g.sleepCycles;
+}
+
+uint64_t hal_host_task_max(HalTask task)
+{
+    return g.taskMax[task];
+}
+
+const Max7219Model* hal_host_display(void)
+{
+    return &g.display;
+}
+
+void hal_host_on_latch(void (*latched)(void* param), void* param)
+{
+    g.latched = latched;
+    g.latchedParam = param;
+}
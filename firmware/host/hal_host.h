@@ -0,0 +1,130 @@
+#pragma once
+
+// Host backend for the HAL (hal.h), so the whole firmware can be built and run natively
+//
+// The ATtiny13A's peripherals are emulated against a virtual clock counted in CPU cycles.
+// Register accesses and delays pass virtual time, and sleeping skips ahead to the next event.
+// Timer0, the pin change and INT0 flags, the ADC and the EEPROM behave as on the chip, and
+// the firmware's interrupt handlers are called when their flags are set. Port B is connected
+// to a scripted GPS (bit-timed UART on PB1, timepulse pulling LOAD low), an LDR and button
+// reading on the ADC, and a model of the MAX7219 chain on PB0, PB2 and PB3.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "max7219.h"
+
+#define HAL_HOST_REGISTERS(X) \
+    X(PORTB) X(DDRB) X(PINB) \
+    X(ADMUX) X(ADCSRA) X(ADCSRB) X(ADCH) X(ADCL) X(DIDR0) X(ACSR) \
+    X(TCCR0A) X(TCCR0B) X(TCNT0) X(TIFR0) X(TIMSK0) X(OCR0A) X(OCR0B) \
+    X(GIFR) X(GIMSK) X(PCMSK) X(MCUCR) X(PRR) X(SREG) \
+    X(EECR) X(EEARL) X(EEDR)
+
+#define HAL_HOST_REGISTER_ENUM(reg) kHalReg_##reg,
+
+typedef enum HalRegister {
+    HAL_HOST_REGISTERS(HAL_HOST_REGISTER_ENUM)
+    kHalReg_Count
+} HalRegister;
+
+// Scheduler tasks in main.c, timed between the firmware's hal_task_start() and hal_task_end()
+typedef enum HalTask {
+    kHalTask_Timepulse,
+    kHalTask_UartByte,
+    kHalTask_Deferred,
+    kHalTask_Button,
+    kHalTask_Count
+} HalTask;
+
+// Virtual cycles each register access takes, standing in for the instructions around it
+#define HAL_HOST_ACCESS_CYCLES 8
+
+// Bytes of EEPROM on the ATtiny13A
+#define HAL_HOST_EEPROM_SIZE 64
+
+// Called by the firmware through hal.h and the stand-in AVR headers in host/include
+uint8_t hal_host_read(HalRegister reg);
+void hal_host_write(HalRegister reg, uint8_t value);
+void hal_host_delay(uint32_t cycles);
+void hal_host_sleep(void);
+void hal_host_idle(void);
+void hal_host_sei(void);
+void hal_host_cli(void);
+bool hal_host_running(void);
+void hal_host_task_start(HalTask task);
+void hal_host_task_end(HalTask task);
+
+/**
+ * Power up: clear the registers and scripted inputs, erase the EEPROM and restart the clock
+ *
+ * The display model is reset for a chain of numChips MAX7219s, and the GPS to sending at BAUD.
+ */
+void hal_host_reset(uint32_t frequency, uint8_t numChips);
+
+/**
+ * Virtual time since hal_host_reset(), in CPU cycles
+ */
+uint64_t hal_host_cycles(void);
+
+/**
+ * Make hal_running() false once virtual time reaches a cycle, so the firmware's main() returns
+ */
+void hal_host_stop_at(uint64_t cycle);
+
+/**
+ * Call a function once virtual time reaches a cycle
+ *
+ * Used to script inputs over a run of main(). The function can schedule itself again.
+ */
+void hal_host_at(uint64_t cycle, void (*event)(void* param), void* param);
+
+/**
+ * Queue bytes for the GPS to send on PB1, starting at a cycle or straight after any bytes
+ * still queued. Each byte is a start bit, 8 data bits and a stop bit at the baud rate.
+ */
+void hal_host_gps_send(uint64_t cycle, const char* bytes, size_t length);
+void hal_host_gps_set_baud(uint32_t baud);
+
+/**
+ * Pull LOAD low for a timepulse starting at a cycle
+ */
+void hal_host_timepulse(uint64_t cycle, uint32_t widthCycles);
+
+/**
+ * Set the 8-bit ADC reading of the LDR, and whether the button is pulling it to zero
+ */
+void hal_host_set_light(uint8_t reading);
+void hal_host_set_button(bool pressed);
+
+uint8_t* hal_host_eeprom(void);
+
+/**
+ * Number of EEPROM writes completed since reset
+ */
+uint32_t hal_host_eeprom_writes(void);
+
+/**
+ * Virtual cycles spent asleep since reset
+ */
+uint64_t hal_host_sleep_cycles(void);
+
+/**
+ * Longest a task has taken between its stamps since reset, in virtual cycles
+ *
+ * Interrupts that ran during the task aren't counted, as they are timed as their own task
+ * where the firmware stamps them. Like the rest of virtual time, this charges each register
+ * access HAL_HOST_ACCESS_CYCLES and code between accesses nothing, so it approximates the
+ * cycles on the chip rather than counting them.
+ */
+uint64_t hal_host_task_max(HalTask task);
+
+const Max7219Model* hal_host_display(void);
+
+/**
+ * Call a function each time LOAD rises and the display model latches what was shifted in
+ *
+ * This is called from inside a register access, so it should only look at the display.
+ */
+void hal_host_on_latch(void (*latched)(void* param), void* param);
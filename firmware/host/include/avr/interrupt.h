@@ -0,0 +1,11 @@
+#pragma once
+
+#include "../../hal_host.h"
+
+// Interrupt handlers become plain functions, which the host backend calls when their flag is
+// set and interrupts are enabled
+#define ISR(vector, ...) void vector(void)
+#define EMPTY_INTERRUPT(vector) void vector(void) {}
+
+#define sei() hal_host_sei()
+#define cli() hal_host_cli()
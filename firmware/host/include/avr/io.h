@@ -0,0 +1,23 @@
+#pragma once
+
+// Minimal stand-in for the avr-libc header so main.c can be built for the host (HAL_HOST)
+// Registers are only reached through REG_READ() and REG_WRITE() (hal.h), so just the bit
+// names are needed here.
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+enum { PB0, PB1, PB2, PB3, PB4, PB5 };
+enum { MUX0, MUX1, ADLAR = 5, REFS0 };
+enum { ADPS0, ADPS1, ADPS2, ADIE, ADIF, ADATE, ADSC, ADEN };
+enum { AIN0D, AIN1D, ADC1D, ADC3D, ADC2D, ADC0D };
+enum { ACIS0, ACIS1, ACIE = 3, ACI, ACO, ACBG, ACD };
+enum { PRADC, PRTIM0 };
+enum { CS00, CS01, CS02 };
+enum { TOV0 = 1, OCF0A, OCF0B };
+enum { TOIE0 = 1, OCIE0A, OCIE0B };
+enum { PCIF = 5, INTF0 };
+enum { PCIE = 5, INT0 };
+enum { ISC00, ISC01, SM0 = 3, SM1, SE };
+enum { EERE, EEPE, EEMPE, EERIE, EEPM0, EEPM1 };
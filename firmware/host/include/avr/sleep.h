@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../../hal_host.h"
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC _BV(SM0)
+#define SLEEP_MODE_PWR_DOWN _BV(SM1)
+
+#define set_sleep_mode(mode) \
+    hal_host_write(kHalReg_MCUCR, (hal_host_read(kHalReg_MCUCR) & ~(_BV(SM0) | _BV(SM1))) | (mode))
+
+#define sleep_enable() hal_host_write(kHalReg_MCUCR, hal_host_read(kHalReg_MCUCR) | _BV(SE))
+#define sleep_disable() hal_host_write(kHalReg_MCUCR, hal_host_read(kHalReg_MCUCR) & ~_BV(SE))
+#define sleep_cpu() hal_host_sleep()
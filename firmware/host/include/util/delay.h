@@ -0,0 +1,7 @@
+#pragma once
+
+#include "../../hal_host.h"
+
+// Delays pass virtual time in the host backend
+#define _delay_us(us) hal_host_delay((uint32_t) ((us) * (F_CPU / 1000000.0)))
+#define _delay_ms(ms) hal_host_delay((uint32_t) ((ms) * (F_CPU / 1000.0)))
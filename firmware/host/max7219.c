@@ -0,0 +1,54 @@
+#include "max7219.h"
+
+#include <string.h>
+
+void max7219_model_init(Max7219Model* model, uint8_t numChips)
+{
+    memset(model, 0, sizeof(*model));
+
+    model->numChips = numChips;
+
+    // The lines idle high until the firmware configures its pins
+    model->load = true;
+}
+
+bool max7219_model_update(Max7219Model* model, bool din, bool clock, bool load)
+{
+    bool latched = false;
+
+    if (clock && !model->clock) {
+        model->shift = (model->shift << 1) | din;
+    }
+
+    if (load && !model->load) {
+        for (uint8_t chip = 0; chip < model->numChips; ++chip) {
+            const uint16_t word = model->shift >> (16 * chip);
+            const uint8_t address = (word >> 8) & 0x0F;
+
+            model->latched[chip] = word;
+
+            if (address != 0) {
+                model->registers[chip][address] = word & 0xFF;
+                model->written[chip] |= 1 << address;
+            }
+        }
+
+        latched = true;
+    }
+
+    model->clock = clock;
+    model->load = load;
+
+    return latched;
+}
+
+uint8_t max7219_model_digit(const Max7219Model* model, uint8_t chip, uint8_t digit)
+{
+    // Power-up contents are undefined
+    if ((model->written[chip] & (1 << digit)) == 0) {
+        return 0xFF;
+    }
+
+    // Code B font: the low nibble selects the character and bit 7 is the decimal point
+    return model->registers[chip][digit] & 0x0F;
+}
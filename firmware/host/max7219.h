@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Most chips the model will decode in a daisy chain
+#define MAX7219_MODEL_MAX_CHIPS 4
+
+/**
+ * Model of a chain of MAX7219s, decoded from the levels on their DIN, CLK and LOAD pins
+ *
+ * Data is shifted in on each rising edge of CLK whatever LOAD is doing, and the last 16 bits
+ * held by each chip are latched into its registers on the rising edge of LOAD.
+ */
+typedef struct Max7219Model {
+    uint8_t numChips;
+
+    // Registers of each chip, indexed by address (0 is the no-op register)
+    uint8_t registers[MAX7219_MODEL_MAX_CHIPS][16];
+
+    // Bit per register of each chip that has been written since power-up
+    uint16_t written[MAX7219_MODEL_MAX_CHIPS];
+
+    // Bits shifted in since power-up: chip 0 (nearest the microcontroller) holds the low 16
+    uint64_t shift;
+
+    // Word latched into each chip by the last LOAD edge
+    uint16_t latched[MAX7219_MODEL_MAX_CHIPS];
+
+    // Pin levels at the last update, to find edges
+    bool clock;
+    bool load;
+} Max7219Model;
+
+void max7219_model_init(Max7219Model* model, uint8_t numChips);
+
+/**
+ * Feed the pin levels after any of them may have changed
+ *
+ * Returns true when this was a rising edge on LOAD, so the latched words have been updated.
+ */
+bool max7219_model_update(Max7219Model* model, bool din, bool clock, bool load);
+
+/**
+ * Get the decoded value (0-9, or 10-15 for "-EHLP ") of a digit register, ignoring the decimal point
+ *
+ * Digits are numbered from 1 as they are on the chip. Returns 0xFF if the register was never written.
+ */
+uint8_t max7219_model_digit(const Max7219Model* model, uint8_t chip, uint8_t digit);
@@ -0,0 +1,429 @@
+#include "nmea_gen.h"
+#include "random.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest sentence NMEA allows, including the '$' and line ending
+#define kMaxSentence 82
+
+static const char* const sentenceNames[kNmeaGen_NumSentences] = {
+    "GGA", "GSA", "GSV", "VTG", "RMC", "ZDA",
+};
+
+void nmea_gen_default_config(NmeaGenConfig* config)
+{
+    *config = (NmeaGenConfig) {
+        .seed = 1,
+        .talker = "GP",
+        .sentences = NMEA_GEN_SENTENCE(kNmeaGen_GGA) | NMEA_GEN_SENTENCE(kNmeaGen_GSA)
+            | NMEA_GEN_SENTENCE(kNmeaGen_GSV) | NMEA_GEN_SENTENCE(kNmeaGen_VTG)
+            | NMEA_GEN_SENTENCE(kNmeaGen_RMC),
+        .gsvMessages = 3,
+        .epochsPerSecond = 1,
+        .baud = 9600,
+        .startTime = 12 * 3600,
+        .day = 4,
+        .month = 2,
+        .year = 19,
+        .fixLossSeconds = 30,
+        .sentenceDelay = 0.03,
+        .ppsWidth = 0.1,
+    };
+}
+
+/**
+ * Data bits to send before the next bit error, so each bit doesn't need its own random number
+ */
+static uint64_t next_error_gap(NmeaGen* gen)
+{
+    const double rate = gen->config.bitErrorRate;
+
+    if (rate <= 0) {
+        return UINT64_MAX;
+    }
+
+    if (rate >= 1) {
+        return 0;
+    }
+
+    // Geometric distribution, keeping the uniform sample away from zero
+    const double u = 1.0 - random_uniform(&gen->random, 0, 1);
+    return (uint64_t) floor(log(u) / log1p(-rate));
+}
+
+static uint8_t days_in_month(uint8_t month, uint8_t year)
+{
+    static const uint8_t days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+
+    if (month == 2 && (year % 4) == 0) {
+        return 29;
+    }
+
+    return days[(month - 1) % 12];
+}
+
+static void next_day(NmeaGen* gen)
+{
+    if (++gen->day > days_in_month(gen->month, gen->year)) {
+        gen->day = 1;
+
+        if (++gen->month > 12) {
+            gen->month = 1;
+            gen->year = (gen->year + 1) % 100;
+        }
+    }
+}
+
+void nmea_gen_init(NmeaGen* gen, const NmeaGenConfig* config)
+{
+    *gen = (NmeaGen) {
+        .config = *config,
+        .random = config->seed,
+        .day = config->day,
+        .month = config->month,
+        .year = config->year,
+    };
+
+    if (gen->config.epochsPerSecond == 0) {
+        gen->config.epochsPerSecond = 1;
+    }
+
+    if (gen->config.gsvMessages == 0) {
+        gen->config.gsvMessages = 1;
+    }
+
+    gen->bitsToNextError = next_error_gap(gen);
+}
+
+void nmea_gen_free(NmeaGen* gen)
+{
+    free(gen->pending);
+    gen->pending = NULL;
+    gen->numPending = 0;
+    gen->head = 0;
+    gen->capacity = 0;
+}
+
+static void add_event(NmeaGen* gen, NmeaGenEvent event)
+{
+    if (gen->numPending == gen->capacity) {
+        gen->capacity = gen->capacity == 0 ? 4096 : gen->capacity * 2;
+        gen->pending = realloc(gen->pending, gen->capacity * sizeof(NmeaGenEvent));
+
+        if (gen->pending == NULL) {
+            fprintf(stderr, "nmea_gen: out of memory\n");
+            abort();
+        }
+    }
+
+    gen->pending[gen->numPending++] = event;
+}
+
+/**
+ * Put the checksum and line ending on a sentence body (without its '$')
+ */
+static size_t finish_sentence(char* sentence, const char* body)
+{
+    uint8_t checksum = 0;
+
+    for (const char* c = body; *c != '\0'; ++c) {
+        checksum ^= *c;
+    }
+
+    const int length = snprintf(sentence, kMaxSentence + 1, "$%s*%02X\r\n", body, checksum);
+    return length < 0 ? 0 : (length > kMaxSentence ? kMaxSentence : length);
+}
+
+typedef struct Epoch {
+    uint32_t utc;
+    uint8_t hundredths;
+    bool hasTime;
+    bool hasFix;
+} Epoch;
+
+/**
+ * Write the body of the nth message of a sentence type for an epoch
+ */
+static void format_body(NmeaGen* gen, const Epoch* epoch, NmeaGenSentence type, uint8_t n,
+                        char* body, size_t size)
+{
+    const NmeaGenConfig* c = &gen->config;
+    const char* talker = c->talker;
+
+    char time[16] = "";
+    char date[12] = "";
+
+    if (epoch->hasTime) {
+        snprintf(time, sizeof(time), "%02u%02u%02u.%02u",
+            epoch->utc / 3600, (epoch->utc / 60) % 60, epoch->utc % 60, epoch->hundredths);
+        snprintf(date, sizeof(date), "%02u%02u%02u", gen->day, gen->month, gen->year);
+    }
+
+    const bool fix = epoch->hasFix;
+
+    switch (type) {
+        case kNmeaGen_GGA:
+            snprintf(body, size, "%sGGA,%s,%s,%s,%s,%s,%s,%s,M,%s,M,,",
+                talker, time,
+                fix ? "5133.82" : "", fix ? "N" : "", fix ? "00042.24" : "", fix ? "W" : "",
+                fix ? "1,08,1.0" : "0,00,99.99", fix ? "10.0" : "", fix ? "47.0" : "");
+            break;
+
+        case kNmeaGen_GSA:
+            snprintf(body, size, "%sGSA,A,%s", talker,
+                fix ? "3,04,05,09,12,24,,,,,,,,2.5,1.3,2.1" : "1,,,,,,,,,,,,,99.99,99.99,99.99");
+            break;
+
+        case kNmeaGen_GSV: {
+            const uint8_t total = c->gsvMessages;
+            const uint8_t first = n * 4 + 1;
+
+            snprintf(body, size, "%sGSV,%u,%u,%02u,%02u,40,083,%s,%02u,17,308,%s,%02u,07,344,%s,%02u,22,228,%s",
+                talker, total, n + 1, total * 4,
+                first, fix ? "46" : "", first + 1, fix ? "41" : "",
+                first + 2, fix ? "39" : "", first + 3, fix ? "45" : "");
+            break;
+        }
+
+        case kNmeaGen_VTG:
+            snprintf(body, size, "%sVTG,%s", talker,
+                fix ? "054.7,T,034.4,M,005.5,N,010.2,K,A" : ",T,,M,,N,,K,N");
+            break;
+
+        case kNmeaGen_RMC:
+            snprintf(body, size, "%sRMC,%s,%s,%s,%s,%s,%s,%s,%s,%s,,,%s",
+                talker, time, fix ? "A" : "V",
+                fix ? "5133.82" : "", fix ? "N" : "", fix ? "00042.24" : "", fix ? "W" : "",
+                fix ? "000.0" : "", fix ? "000.0" : "", date, fix ? "A" : "N");
+            break;
+
+        case kNmeaGen_ZDA:
+            if (epoch->hasTime) {
+                snprintf(body, size, "%sZDA,%s,%02u,%02u,20%02u,00,00",
+                    talker, time, gen->day, gen->month, gen->year);
+            } else {
+                snprintf(body, size, "%sZDA,,,,,00,00", talker);
+            }
+            break;
+
+        default:
+            body[0] = '\0';
+            break;
+    }
+}
+
+/**
+ * Send a sentence from a time, with any truncation and bit errors, returning when it ends
+ */
+static double send_sentence(NmeaGen* gen, const Epoch* epoch, NmeaGenSentence type,
+                            const char* sentence, size_t length, double start)
+{
+    const NmeaGenConfig* c = &gen->config;
+    const double byteTime = 10.0 / c->baud;
+
+    bool truncated = false;
+
+    // Cut short somewhere after the '$', as when a receiver's output buffer overflows
+    if (c->truncationRate > 0 && random_uniform(&gen->random, 0, 1) < c->truncationRate) {
+        length = 1 + (size_t) random_uniform(&gen->random, 0, length - 1);
+        truncated = true;
+        ++gen->stats.truncated;
+    }
+
+    bool corrupted = false;
+
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t byte = sentence[i];
+
+        for (uint8_t bit = 0; bit < 8; ++bit) {
+            if (gen->bitsToNextError == 0) {
+                byte ^= 1 << bit;
+                corrupted = true;
+                ++gen->stats.bitErrors;
+                gen->bitsToNextError = next_error_gap(gen);
+            } else if (gen->bitsToNextError != UINT64_MAX) {
+                --gen->bitsToNextError;
+            }
+        }
+
+        add_event(gen, (NmeaGenEvent) {
+            .time = start + i * byteTime,
+            .type = kNmeaGen_Byte,
+            .value = byte,
+            .utc = epoch->utc,
+        });
+    }
+
+    ++gen->stats.sentences;
+    gen->stats.bytes += length;
+
+    if (corrupted) {
+        ++gen->stats.corrupted;
+    }
+
+    if (type == kNmeaGen_RMC) {
+        ++gen->stats.rmcSentences;
+
+        if (!truncated && !corrupted) {
+            ++gen->stats.rmcIntact;
+
+            if (epoch->hasTime) {
+                ++gen->stats.rmcWithTime;
+            }
+        }
+    }
+
+    return start + length * byteTime;
+}
+
+/**
+ * Sort events into time order. They're generated nearly in order, so this is an insertion sort.
+ */
+static void sort_events(NmeaGenEvent* events, size_t count)
+{
+    for (size_t i = 1; i < count; ++i) {
+        const NmeaGenEvent event = events[i];
+        size_t j = i;
+
+        while (j > 0 && events[j - 1].time > event.time) {
+            events[j] = events[j - 1];
+            --j;
+        }
+
+        events[j] = event;
+    }
+}
+
+/**
+ * Generate the timepulse and every epoch of the next second
+ */
+static void generate_second(NmeaGen* gen)
+{
+    const NmeaGenConfig* c = &gen->config;
+    const uint32_t second = gen->second++;
+    const uint64_t absolute = (uint64_t) c->startTime + second;
+
+    // Move the date on at each midnight after the first second
+    if (second != 0 && absolute % 86400 == 0) {
+        next_day(gen);
+    }
+
+    const bool hasTime = second >= c->timeAfter;
+    bool hasFix = second >= c->fixAfter && second >= gen->outageEnd;
+
+    if (hasFix && c->fixLossesPerHour > 0 && random_uniform(&gen->random, 0, 3600) < c->fixLossesPerHour) {
+        gen->outageEnd = second + 1 + random_uniform(&gen->random, 0, c->fixLossSeconds > 1 ? c->fixLossSeconds - 1 : 0);
+        hasFix = false;
+    }
+
+    // Drop events already handed out before adding more
+    if (gen->head != 0) {
+        memmove(gen->pending, gen->pending + gen->head, (gen->numPending - gen->head) * sizeof(NmeaGenEvent));
+        gen->numPending -= gen->head;
+        gen->head = 0;
+    }
+
+    const uint32_t utc = absolute % 86400;
+
+    if (hasFix || c->ppsWithoutFix) {
+        const double start = second + c->ppsOffset + random_uniform(&gen->random, -c->ppsJitter, c->ppsJitter);
+
+        add_event(gen, (NmeaGenEvent) {.time = start, .type = kNmeaGen_PulseStart, .utc = utc});
+        add_event(gen, (NmeaGenEvent) {.time = start + c->ppsWidth, .type = kNmeaGen_PulseEnd, .utc = utc});
+        ++gen->stats.pulses;
+    }
+
+    for (uint8_t e = 0; e < c->epochsPerSecond; ++e) {
+        const Epoch epoch = {
+            .utc = utc,
+            .hundredths = e * 100 / c->epochsPerSecond,
+            .hasTime = hasTime,
+            .hasFix = hasFix,
+        };
+
+        double start = second + (double) e / c->epochsPerSecond + c->sentenceDelay
+            + random_uniform(&gen->random, 0, c->sentenceJitter);
+
+        // A receiver sends each epoch once the last has gone
+        if (start < gen->txEnd) {
+            start = gen->txEnd;
+            ++gen->stats.lateEpochs;
+        }
+
+        for (NmeaGenSentence type = 0; type < kNmeaGen_NumSentences; ++type) {
+            if ((c->sentences & NMEA_GEN_SENTENCE(type)) == 0) {
+                continue;
+            }
+
+            const uint8_t messages = type == kNmeaGen_GSV ? c->gsvMessages : 1;
+
+            for (uint8_t n = 0; n < messages; ++n) {
+                char body[kMaxSentence];
+                char sentence[kMaxSentence + 1];
+
+                format_body(gen, &epoch, type, n, body, sizeof(body));
+                const size_t length = finish_sentence(sentence, body);
+
+                start = send_sentence(gen, &epoch, type, sentence, length, start);
+            }
+        }
+
+        gen->txEnd = start;
+    }
+
+    ++gen->stats.seconds;
+
+    sort_events(gen->pending, gen->numPending);
+}
+
+const NmeaGenEvent* nmea_gen_peek(NmeaGen* gen)
+{
+    const NmeaGenConfig* c = &gen->config;
+
+    // Nothing from a later second can come before this: its timepulse can be early, but its
+    // sentences can't start before the second does
+    const double earliest = fmin(0, c->ppsOffset - c->ppsJitter);
+
+    while (gen->head == gen->numPending || gen->pending[gen->head].time >= gen->second + earliest) {
+        generate_second(gen);
+    }
+
+    return &gen->pending[gen->head];
+}
+
+void nmea_gen_next(NmeaGen* gen, NmeaGenEvent* event)
+{
+    *event = *nmea_gen_peek(gen);
+    ++gen->head;
+}
+
+bool nmea_gen_parse_sentences(const char* list, uint8_t* sentences)
+{
+    *sentences = 0;
+
+    while (*list != '\0') {
+        const size_t length = strcspn(list, ",");
+        bool known = false;
+
+        for (NmeaGenSentence type = 0; type < kNmeaGen_NumSentences; ++type) {
+            if (length == strlen(sentenceNames[type]) && strncmp(list, sentenceNames[type], length) == 0) {
+                *sentences |= NMEA_GEN_SENTENCE(type);
+                known = true;
+            }
+        }
+
+        if (!known) {
+            return false;
+        }
+
+        list += length;
+        if (*list == ',') {
+            ++list;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+// NMEA sentences and timepulses from a simulated GPS receiver, for load testing
+//
+// Traffic is generated a second at a time from a seeded configuration and handed out as a
+// stream of events in time order: the start bit of each byte on the UART, and each edge of
+// the timepulse. The sentence mix, update rate, fix acquisition and loss, baud rate and
+// timepulse offset and jitter are configurable, as are faults: sentences cut short, and
+// bit errors at a given rate. The same seed always gives the same stream.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum NmeaGenSentence {
+    kNmeaGen_GGA,
+    kNmeaGen_GSA,
+    kNmeaGen_GSV,
+    kNmeaGen_VTG,
+    kNmeaGen_RMC,
+    kNmeaGen_ZDA,
+    kNmeaGen_NumSentences,
+} NmeaGenSentence;
+
+// Bit for a sentence in NmeaGenConfig.sentences
+#define NMEA_GEN_SENTENCE(sentence) (1 << (sentence))
+
+typedef struct NmeaGenConfig {
+    uint64_t seed;
+
+    // Talker ID on every sentence, eg. "GP" for GPS only or "GN" for multi-constellation
+    char talker[3];
+
+    // NMEA_GEN_SENTENCE() bits, sent in the order of NmeaGenSentence each epoch
+    uint8_t sentences;
+    uint8_t gsvMessages; // 1-4, each describing four satellites
+    uint8_t epochsPerSecond; // 1-10
+    uint32_t baud;
+
+    // UTC of the first second, as seconds since midnight and a date
+    uint32_t startTime;
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;
+
+    // Seconds from the start until the receiver knows the time (sentences have blank time
+    // fields before this), then until it has a fix
+    double timeAfter;
+    double fixAfter;
+
+    // Outages after the first fix, each up to fixLossSeconds long
+    double fixLossesPerHour;
+    double fixLossSeconds;
+
+    // Seconds from the start of each epoch to its first sentence, plus up to sentenceJitter
+    double sentenceDelay;
+    double sentenceJitter;
+
+    // The timepulse: seconds early (negative) or late against the true second, the largest
+    // random change either way on each pulse, and its width
+    double ppsOffset;
+    double ppsJitter;
+    double ppsWidth;
+
+    // Keep sending timepulses without a fix (as a receiver with a good time estimate can)
+    bool ppsWithoutFix;
+
+    // Chance of each sentence being cut short, and of each data bit being flipped
+    double truncationRate;
+    double bitErrorRate;
+} NmeaGenConfig;
+
+typedef enum NmeaGenEventType {
+    kNmeaGen_Byte,
+    kNmeaGen_PulseStart,
+    kNmeaGen_PulseEnd,
+} NmeaGenEventType;
+
+typedef struct NmeaGenEvent {
+    // Seconds since the start of the stream: the start of the start bit for a byte
+    double time;
+
+    NmeaGenEventType type;
+    uint8_t value; // Byte sent
+
+    // UTC seconds since midnight of the epoch a byte's sentence describes, or the second a
+    // timepulse marks
+    uint32_t utc;
+} NmeaGenEvent;
+
+/**
+ * Totals over everything generated so far, to check a parser's results against
+ */
+typedef struct NmeaGenStats {
+    uint32_t seconds;
+    uint32_t pulses;
+    uint32_t sentences;
+    uint32_t rmcSentences;
+    uint32_t rmcIntact; // RMC sentences sent whole and without bit errors
+    uint32_t rmcWithTime; // ...and with the time filled in
+    uint32_t truncated;
+    uint32_t corrupted; // Sentences with at least one bit error
+    uint64_t bitErrors;
+    uint64_t bytes;
+    uint32_t lateEpochs; // Epochs that couldn't start on time as the last was still sending
+} NmeaGenStats;
+
+typedef struct NmeaGen {
+    NmeaGenConfig config;
+    NmeaGenStats stats;
+    uint64_t random;
+
+    uint32_t second; // Next second to generate
+    double txEnd; // When the UART is free after the bytes generated so far
+    double outageEnd;
+    uint64_t bitsToNextError;
+    uint8_t day;
+    uint8_t month;
+    uint8_t year;
+
+    // Generated events not handed out yet, in time order from head
+    NmeaGenEvent* pending;
+    size_t numPending;
+    size_t head;
+    size_t capacity;
+} NmeaGen;
+
+/**
+ * A GPS-only receiver at 1Hz and 9600 baud with a fix from the start, sending GGA, GSA, GSV,
+ * VTG and RMC 30ms after a 100ms timepulse
+ */
+void nmea_gen_default_config(NmeaGenConfig* config);
+
+void nmea_gen_init(NmeaGen* gen, const NmeaGenConfig* config);
+void nmea_gen_free(NmeaGen* gen);
+
+/**
+ * Take the next event in time order. The stream never ends.
+ */
+void nmea_gen_next(NmeaGen* gen, NmeaGenEvent* event);
+
+/**
+ * Look at the next event without taking it
+ */
+const NmeaGenEvent* nmea_gen_peek(NmeaGen* gen);
+
+/**
+ * Parse a comma separated list of sentence names (eg. "GGA,RMC") into NMEA_GEN_SENTENCE() bits
+ *
+ * Returns false if a name isn't known.
+ */
+bool nmea_gen_parse_sentences(const char* list, uint8_t* sentences);
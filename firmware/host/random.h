@@ -0,0 +1,32 @@
+#pragma once
+
+// Seeded random numbers for the host tools, so a run can be repeated from its seed
+
+#include <stdint.h>
+
+/**
+ * splitmix64, which gives well-spread streams from consecutive seeds
+ */
+static inline uint64_t random_next(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Uniform in [min, max)
+ */
+static inline double random_uniform(uint64_t* state, double min, double max)
+{
+    return min + (max - min) * ((random_next(state) >> 11) * 0x1.0p-53);
+}
+
+/**
+ * Uniform in [0, limit), with a bias towards low values too small to matter for small limits
+ */
+static inline uint32_t random_below(uint64_t* state, uint32_t limit)
+{
+    return random_next(state) % limit;
+}
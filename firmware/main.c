@@ -3,6 +3,22 @@
 #include <util/delay.h>
 #include <stdbool.h>
 
+#include "config.h"
+#include "hal.h"
+
+#if defined(ENABLE_SLEEP) || defined(ENABLE_ADC_SLEEP)
+#include <avr/sleep.h>
+#endif
+
+#ifdef ENABLE_PPS_STATS
+// Timer0 count when the start bit of the last UART byte arrived
+static volatile uint8_t _uartByteStart = 0;
+#define UART_START_BIT_HOOK() (_uartByteStart = REG_READ(TCNT0))
+
+static inline void stats_sentence_start();
+#define NMEA_SENTENCE_START_HOOK() stats_sentence_start()
+#endif
+
 // Include sources directly so the compiler can optimise everything together
 // This saves a significant amount of code space
 #include "softuart.c"
@@ -13,45 +29,239 @@
 #define PIN_LOAD PB3
 #define PIN_LIGHT_SENSE PB4
 
+// The 200mV offset prevents the LDR output dropping below around 10 in an 8-bit reading
+// When the button is pressed the reading should drop to zero.
+#define kButtonThreshold 8
+
+// Whole Timer0 overflows in a number of milliseconds
+#define OVERFLOWS_IN_MS(ms) ((ms) * (F_CPU / 1000UL) / TIMER0_PRESCALER / 256)
+
+// Timer overflows without a UART byte after this second's RMC before deferred work can run
+// (~110ms). The GPS sends its sentences back to back, so this means they've finished.
+#define kQuietGapTicks OVERFLOWS_IN_MS(110)
+
+// Timer overflows without a UART byte before ENABLE_PPS_LATCH sends the rest of the display
+// The first may have been flagged while the last sentence was read, so three are at least
+// one whole overflow period (~27ms at 9.6MHz) without a byte. The GPS sends its sentences
+// back to back, so the gaps between them are far shorter than that.
+#define kLatchQuietTicks 3
+
+// Timer overflows without a UART byte or timepulse before deferred work runs anyway (~1.2s)
+// This keeps the brightness and timezone working while the GPS isn't sending at all.
+#define kQuietIdleTicks OVERFLOWS_IN_MS(1200)
+
+// Timer overflows the button is held for before each timezone step (~430ms)
+#define kButtonStepTicks OVERFLOWS_IN_MS(437)
+
 #define EEPROM_TIMEZONE_ADDR 0
+#define EEPROM_TICKS_PER_SECOND_ADDR 1 // Two bytes
 #define kNumDigits 6
 
+#ifdef ENABLE_DARK_SHUTDOWN
+// Averaged LDR readings to shut the display down below and wake it above
+// The gap between the two stops the display flickering on and off around a single level
+#ifndef DARK_SHUTDOWN_LEVEL
+#define DARK_SHUTDOWN_LEVEL 14
+#endif
+
+#ifndef DARK_WAKE_LEVEL
+#define DARK_WAKE_LEVEL 22
+#endif
+
+#if DARK_WAKE_LEVEL <= DARK_SHUTDOWN_LEVEL
+#error "DARK_WAKE_LEVEL must be above DARK_SHUTDOWN_LEVEL"
+#endif
+#endif
+
+// Number of cascaded MAX7219 drivers
+// The first chip in the chain drives the hh:mm:ss display and the second a DD-MM-YY date
+// display. Any further chips are left blank.
+#ifndef MAX7219_CHAIN_LENGTH
+#define MAX7219_CHAIN_LENGTH 1
+#endif
+
+#define kNumChips MAX7219_CHAIN_LENGTH
+
+#if kNumChips > 1
+#ifndef ENABLE_GPS_DATE
+#error "A chain of MAX7219 drivers is used to display the date, which requires ENABLE_GPS_DATE"
+#endif
+
+// Digits in the display buffer for each chip (all eight digit registers)
+#define kChipDigits 8
+#else
+#define kChipDigits kNumDigits
+#endif
+
 static int8_t _timezoneOffset = 0;
+
+// Timer overflows the button has been held for since the last step, or zero if released
+static uint8_t _buttonHeldTicks = 0;
+
+// Timer overflows since the last UART byte or timepulse (saturates at 255)
+static volatile uint8_t _quietTicks = 0;
+
+// Set when a sentence the parser recognised as RMC ends, until the next timepulse starts
+// The GPS may start its sentences any time after the timepulse, so the quiet gap can only
+// open once they've been sent.
+static volatile bool _burstDone = false;
+
+// Deferred jobs that were still running when the GPS started sending a byte (wraps at 255)
+static uint8_t _deferredOverruns = 0;
 static GpsTime _gpsTime = {0, 0, 0};
 
-static uint8_t _display_buf[kNumDigits];
+static uint8_t _display_buf[kNumChips * kChipDigits];
+
+#if kNumChips > 1
+// Bit per digit register for each chip, set once the buffered value has been sent
+// This is "clean" rather than "dirty" so everything is sent after start-up without
+// needing initialised data (which the startup code doesn't copy)
+static uint8_t _display_clean[kNumChips];
+#endif
 
 static inline void setup_pins()
 {
     // Load/CS pin is active low - initialise as high
-    PORTB = _BV(PIN_LOAD);
+    REG_WRITE(PORTB, _BV(PIN_LOAD));
 
-    // MAX7219 pins as output
+    // MAX7219 pins as output, except LOAD which idles as an input with pull-up so the
+    // timepulse can pull it low. It is only driven while data is clocked out.
     // Soft UART and LDR are inputs by omission
-    DDRB = _BV(PIN_MOSI) | _BV(PIN_SCK) | _BV(PIN_LOAD);
+    REG_WRITE(DDRB, _BV(PIN_MOSI) | _BV(PIN_SCK));
 }
 
 static inline void setup_adc()
 {
+    // The analog comparator isn't used
+    REG_WRITE(ACSR, _BV(ACD));
+
+    // PB4 (PIN_LIGHT_SENSE) is only read through the ADC, so its digital input isn't needed
+    // This runs before the timepulse seen flag in DIDR0 is used
+    REG_WRITE(DIDR0, _BV(ADC2D));
+
     // Select PB4 (PIN_LIGHT_SENSE) in the ADC multiplexer
     // Put the significant 8-bits in the upper register as we only want to read that
-    ADMUX = _BV(MUX1) | _BV(ADLAR);
+    REG_WRITE(ADMUX, _BV(MUX1) | _BV(ADLAR));
+
+#ifdef ENABLE_ADC_SLEEP
+    // Conversions are taken on demand by adc_read(): keep the ADC powered down until then
+    REG_WRITE(PRR, _BV(PRADC));
+
+#ifndef ENABLE_TIMEBASE
+    // Sleep through conversions in ADC noise reduction mode, which also stops the I/O clock
+    // This stops Timer0 for each conversion too, which only stretches each Timer0 overflow by ~1%.
+    // Builds with the timebase sleep in idle instead, which stops the CPU but not Timer0.
+    set_sleep_mode(SLEEP_MODE_ADC);
+#endif
+#else
+    // Enable free-running ADC conversions at 75kHz
+    REG_WRITE(ADCSRA, _BV(ADATE) | _BV(ADEN) | _BV(ADSC) | ADC_PRESCALE_SELECT);
+#endif
+}
+
+#ifdef ENABLE_ADC_SLEEP
+// Only here to wake the CPU when a conversion completes
+EMPTY_INTERRUPT(ADC_vect);
+
+/**
+ * Take a single reading of the LDR and button, powering the ADC up for it
+ *
+ * The ADC takes 25 ADC clocks (~0.33ms) for the first conversion after it's powered up. With
+ * sleep set the CPU sleeps through it, sleeping again if another interrupt wakes it first. A
+ * start bit can't be seen while asleep, so when the GPS may be sending this waits awake instead
+ * and gives up on the reading as soon as the UART line falls, returning 0xFF.
+ */
+static uint8_t adc_read(const bool sleep)
+{
+    REG_WRITE(PRR, 0);
+
+    // Start a conversion at 75kHz and interrupt when it completes
+    REG_WRITE(ADCSRA, _BV(ADEN) | _BV(ADSC) | _BV(ADIE) | ADC_PRESCALE_SELECT);
+
+    while (REG_READ(ADCSRA) & _BV(ADSC)) {
+        if (!sleep) {
+            // Leave the conversion for the UART task to receive the byte
+            if ((REG_READ(PINB) & _BV(PIN_SOFT_RX)) == 0) {
+                break;
+            }
+
+            continue;
+        }
+
+        // The instruction after sei() runs before any pending interrupt, so the wake-up
+        // from a conversion that completes first can't be missed
+        cli();
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
 
-    // Enable free-running ADC conversions with largest prescaler
-    ADCSRA = _BV(ADATE) | _BV(ADEN) | _BV(ADSC)
-        | _BV(ADPS0) | _BV(ADPS1) | _BV(ADPS2);
+    const uint8_t reading = (REG_READ(ADCSRA) & _BV(ADSC)) ? 0xFF : REG_READ(ADCH);
+
+    // Power the ADC down until the next reading
+    REG_WRITE(ADCSRA, 0);
+    REG_WRITE(PRR, _BV(PRADC));
+
+    return reading;
+}
+#else
+static inline uint8_t adc_read(const bool sleep)
+{
+    // Latest result from the free-running conversions, so there's never a wait to sleep through
+    return REG_READ(ADCH);
 }
+#endif
 
 static inline void setup_timer()
 {
-    // Run TIM0 with 1024 prescaler
-    TCCR0B = _BV(CS00) | _BV(CS02);
+    // Run TIM0 with the prescaler for this clock (1024 at 9.6MHz)
+    REG_WRITE(TCCR0B, TIMER0_CLOCK_SELECT);
+
+    // Flag falling edges on the UART line in INTF0 (PB1 is also INT0)
+    // The interrupt isn't enabled: the flag is checked after deferred jobs
+    // The sleep mode bits in MCUCR are kept: idle unless setup_adc() selected ADC noise reduction
+    REG_SET(MCUCR, _BV(ISC01));
+
+#ifdef ENABLE_TIMEBASE
+    // Count overflows to extend the timer to 16 bits
+    REG_WRITE(TIMSK0, _BV(TOIE0));
+#endif
+}
+
+#ifdef ENABLE_TIMEBASE
+static volatile uint8_t _timerOverflows = 0;
+#endif
+
+// Sleeping only needs the overflow interrupt to wake it, not the time
+#if defined(ENABLE_TELEMETRY) || defined(ENABLE_HOLDOVER) || defined(ENABLE_PPS_STATS)
+/**
+ * Get the current time in Timer0 ticks (TIMER0_PRESCALER CPU cycles), wrapping every 65536 ticks
+ */
+static uint16_t timebase_now()
+{
+    uint8_t high;
+    uint8_t low;
+
+    // Read the overflow count either side of the timer to catch it overflowing in between
+    do {
+        high = _timerOverflows;
+        low = REG_READ(TCNT0);
+    } while (high != _timerOverflows);
+
+    // Inside another interrupt the overflow may not have been counted yet
+    if ((REG_READ(TIFR0) & _BV(TOV0)) && low < 128) {
+        ++high;
+    }
+
+    return (high << 8) | low;
 }
+#endif
 
 __attribute__ ((unused))
 static void eeprom_wait_for_write()
 {
-    while(EECR & (1<<EEPE));
+    while(REG_READ(EECR) & (1<<EEPE));
 }
 
 static void unchecked_eeprom_write(uint8_t address, uint8_t data)
@@ -60,33 +270,95 @@ static void unchecked_eeprom_write(uint8_t address, uint8_t data)
     // This is a code size optimisation as we only write a single byte infrequently
 
     // Set Programming mode
-    EECR = (0 << EEPM1) | (0 >> EEPM0);
+    REG_WRITE(EECR, (0 << EEPM1) | (0 >> EEPM0));
+
+    // An interrupt in the sequence below could move EEARL or delay EEPE past the four
+    // cycles EEMPE stays set for, so hold them off until the write has started
+    const uint8_t sreg = REG_READ(SREG);
+    cli();
 
     // Set up address and data registers
-    EEARL = address;
-    EEDR = data;
+    REG_WRITE(EEARL, address);
+    REG_WRITE(EEDR, data);
 
     // Write logical one to EEMPE
-    EECR |= (1 << EEMPE);
+    REG_SET(EECR, _BV(EEMPE));
     // Start eeprom write by setting EEPE
-    EECR |= (1 << EEPE);
+    REG_SET(EECR, _BV(EEPE));
+
+    REG_WRITE(SREG, sreg);
 }
 
 static uint8_t unchecked_eeprom_read(uint8_t address)
 {
     // Note: this doesn't wait for completion of any previous write
-    // This is a code size optimisation as we only read at start-up, before any writes
+    // This is a code size optimisation: check EEPE first if a write could be in progress
 
     // Set up address register
-    EEARL = address;
+    REG_WRITE(EEARL, address);
 
     // Start eeprom read by writing EERE
-    EECR |= (1 << EERE);
+    REG_SET(EECR, _BV(EERE));
 
     // Return data from data register
-    return EEDR;
+    return REG_READ(EEDR);
+}
+
+#ifdef ENABLE_SPI_UNROLLED
+
+/**
+ * Clock out a command and data pair to the MAX7219 (SPI-like)
+ *
+ * Each byte is clocked out by an unrolled sequence with a fixed cost of 5 cycles per bit:
+ * the skip over the single word instruction that raises MOSI takes the same time as
+ * executing it. With 6 cycles of setup and 3 per byte for the loop, a word takes 93 cycles
+ * by the instruction set's timings, before any call and return. PORTB is written whole, so
+ * nothing else may change PORTB while this runs.
+ */
+static void spi_send_16(uint16_t value)
+{
+    uint8_t clockLow;
+    uint8_t dataHigh;
+    uint8_t current;
+    uint8_t remaining;
+
+    __asm__ __volatile__ (
+        // Precompute port values for SCK low with MOSI low and high
+        "in   %[lo], %[port]"       "\n\t"
+        "andi %[lo], %[clearMask]"  "\n\t"
+        "mov  %[hi], %[lo]"         "\n\t"
+        "ori  %[hi], %[mosiBit]"    "\n\t"
+
+        // Address byte first, then data byte
+        "mov  %[cur], %B[value]"    "\n\t"
+        "ldi  %[n], 2"              "\n\t"
+
+        "1:"                        "\n\t"
+        ".irp bit, 7, 6, 5, 4, 3, 2, 1, 0" "\n\t"
+        "out  %[port], %[lo]"       "\n\t" // Clock low, output 0
+        "sbrc %[cur], \\bit"        "\n\t"
+        "out  %[port], %[hi]"       "\n\t" // Output 1 if this bit is set
+        "sbi  %[port], %[sckPin]"   "\n\t" // Bring clock high to send bit
+        ".endr"                     "\n\t"
+
+        "mov  %[cur], %A[value]"    "\n\t"
+        "dec  %[n]"                 "\n\t"
+        "brne 1b"                   "\n\t"
+
+        : [lo] "=&d" (clockLow),
+          [hi] "=&d" (dataHigh),
+          [cur] "=&r" (current),
+          [n] "=&d" (remaining)
+        : [value] "r" (value),
+          [port] "I" (_SFR_IO_ADDR(PORTB)),
+          [clearMask] "M" ((uint8_t) ~(_BV(PIN_SCK) | _BV(PIN_MOSI))),
+          [mosiBit] "M" (_BV(PIN_MOSI)),
+          [sckPin] "I" (PIN_SCK)
+    );
 }
 
+#else
+
 /**
  * Clock out a command and data pair to the MAX7219 (SPI-like)
  */
@@ -95,46 +367,157 @@ static void spi_send_16(uint16_t value)
     // Clock out 8 bits, MSB first
     for (uint8_t i = 16; i != 0; --i) {
         // Bring the clock low
-        PORTB &= ~_BV(PIN_SCK);
+        REG_CLEAR(PORTB, _BV(PIN_SCK));
 
         // Set output to 0
-        PORTB &= ~_BV(PIN_MOSI);
+        REG_CLEAR(PORTB, _BV(PIN_MOSI));
 
         // Set output to 1 if this bit is set
         if (value & 0x8000) {
-            PORTB |= _BV(PIN_MOSI);
+            REG_SET(PORTB, _BV(PIN_MOSI));
         }
 
         // Bring clock high to send bit
-        PORTB |= _BV(PIN_SCK);
+        REG_SET(PORTB, _BV(PIN_SCK));
 
         // Next bit
         value <<= 1;
     }
 }
 
+#endif
+
+#ifdef ENABLE_PPS_LATCH
+// Set while the MAX7219 shift register holds the pending seconds digit for the timepulse to
+// latch, until anything else is clocked out or the digit changes
+static bool _secondsPreloaded = false;
+#endif
+
+// Set while the timepulse is holding LOAD low, so each pulse is only handled once
+static volatile bool _timepulseActive = false;
+
+/**
+ * Drive LOAD high while data is clocked out
+ *
+ * LOAD idles as an input so the timepulse can pull it low and set PCIF. While it's
+ * being driven, the end of a timepulse can't latch a partially shifted word.
+ */
+static inline void load_acquire()
+{
+    REG_SET(DDRB, _BV(PIN_LOAD));
+
+#ifdef ENABLE_PPS_LATCH
+    _secondsPreloaded = false;
+#endif
+}
+
+/**
+ * Hand LOAD back to the timepulse
+ */
+static inline void load_release()
+{
+    REG_CLEAR(DDRB, _BV(PIN_LOAD));
+
+    // Let the input synchroniser catch up before reading the pin
+    hal_delay_cycles(2);
+
+    // Driving LOAD sets the pin change flag. Clear it, unless the timepulse started or ended
+    // while LOAD was driven: that edge was hidden, and the handler still needs to run for it.
+    const bool lineLow = (REG_READ(PINB) & _BV(PIN_LOAD)) == 0;
+
+    if (lineLow == _timepulseActive) {
+        REG_WRITE(GIFR, _BV(PCIF));
+    }
+}
+
 /**
- * Write to a register on the MAX7219
+ * Write to a register on the MAX7219 (on every chip if there is more than one)
  */
 static void max7219_cmd(uint8_t address, uint8_t data)
 {
+#ifdef ENABLE_PPS_INTERRUPT
+    // The timepulse interrupt also sends commands: keep it out until this one is latched
+    const uint8_t sreg = REG_READ(SREG);
+    cli();
+#endif
+
+    load_acquire();
+
     // Select chip (active low)
-    PORTB &= ~_BV(PIN_LOAD);
+    REG_CLEAR(PORTB, _BV(PIN_LOAD));
 
     // Clock out address and data as a combined word for code size savings
-    spi_send_16((address << 8) | data);
+    // When chained, each chip passes the previous word on as the next one is shifted in
+    for (uint8_t i = kNumChips; i != 0; --i) {
+        spi_send_16((address << 8) | data);
+    }
 
     // Pull chip select high to latch data
-    PORTB |= _BV(PIN_LOAD);
+    REG_SET(PORTB, _BV(PIN_LOAD));
+
+    load_release();
+
+#ifdef ENABLE_PPS_INTERRUPT
+    REG_WRITE(SREG, sreg);
+#endif
+}
+
+#if kNumChips > 1
+/**
+ * Write one register on a subset of the chained MAX7219s in a single LOAD cycle
+ *
+ * The data for chip n is read from data[n * kChipDigits], so this can be passed a pointer
+ * into the display buffer. Chips without their bit set in chipMask are sent a no-op.
+ */
+static void max7219_cmd_chain(uint8_t address, const uint8_t* data, uint8_t chipMask)
+{
+#ifdef ENABLE_PPS_INTERRUPT
+    const uint8_t sreg = REG_READ(SREG);
+    cli();
+#endif
+
+    load_acquire();
+    REG_CLEAR(PORTB, _BV(PIN_LOAD));
+
+    // The first word clocked out ends up in the chip furthest from the microcontroller
+    for (int8_t chip = kNumChips - 1; chip >= 0; --chip) {
+        uint16_t word = 0x0000; // No-op register
+
+        if (chipMask & _BV(chip)) {
+            word = (address << 8) | data[chip * kChipDigits];
+        }
+
+        spi_send_16(word);
+    }
+
+    REG_SET(PORTB, _BV(PIN_LOAD));
+    load_release();
+
+#ifdef ENABLE_PPS_INTERRUPT
+    REG_WRITE(SREG, sreg);
+#endif
 }
+#endif
 
 /**
  * Configure the MAX7219 for use
  */
 static void max7219_init()
 {
+#if kNumChips > 1
+    // Set scan mode to 6 digits for the time and all 8 digits on the chips after it for the
+    // date, in one LOAD cycle. Each chip's value is staged in its first slot of the display
+    // buffer, which main() clears after this.
+    for (uint8_t chip = kNumChips - 1; chip != 0; --chip) {
+        _display_buf[chip * kChipDigits] = kChipDigits - 1;
+    }
+
+    _display_buf[0] = kNumDigits;
+    max7219_cmd_chain(0x0B, _display_buf, _BV(kNumChips) - 1);
+#else
     // Set scan mode to 6 digits
     max7219_cmd(0x0B, kNumDigits);
+#endif
 
     // Disable test mode
     max7219_cmd(0x0F, 0);
@@ -146,6 +529,63 @@ static void max7219_init()
     max7219_cmd(0x0C, 1);
 }
 
+#if kNumChips > 1
+static uint8_t days_in_month(GpsTime* now)
+{
+    static const __flash uint8_t daysInMonth[] = {
+        31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+
+    uint8_t days = daysInMonth[now->month - 1];
+
+    // RMC only has a two digit year: in 2000-2099 every fourth year is a leap year
+    if (now->month == 2 && (now->year & 0x3) == 0) {
+        ++days;
+    }
+
+    return days;
+}
+
+static void increment_date(GpsTime* now)
+{
+    // Leave a missing date as zeros: days_in_month() has no month 0
+    if (now->month == 0) {
+        return;
+    }
+
+    if (++now->day > days_in_month(now)) {
+        now->day = 1;
+
+        if (++now->month > 12) {
+            now->month = 1;
+
+            if (++now->year == 100) {
+                now->year = 0;
+            }
+        }
+    }
+}
+
+static void decrement_date(GpsTime* now)
+{
+    if (now->month == 0) {
+        return;
+    }
+
+    if (--now->day == 0) {
+        if (--now->month == 0) {
+            now->month = 12;
+
+            if (now->year-- == 0) {
+                now->year = 99;
+            }
+        }
+
+        now->day = days_in_month(now);
+    }
+}
+#endif
+
 /**
  * Modify the passed time with the current timezone offset
  */
@@ -155,10 +595,17 @@ static void apply_timezone_offset(GpsTime* now)
     int8_t hour = now->hour;
     hour += _timezoneOffset;
 
+    // The date only needs to follow the hour when it's displayed
     if (hour > 23) {
         hour -= 24;
+#if kNumChips > 1
+        increment_date(now);
+#endif
     } else if (hour < 0) {
         hour += 24;
+#if kNumChips > 1
+        decrement_date(now);
+#endif
     }
 
     now->hour = hour;
@@ -169,19 +616,24 @@ static inline void set_display_pending_flag()
 {
     // Re-purpose an unused register for single instruction set/clear
     // The reset pin isn't used as I/O, so this changing its registers has no effect
-    DDRB |= _BV(PB5);
+    REG_SET(DDRB, _BV(PB5));
+
+#ifdef ENABLE_PPS_LATCH
+    // The pending seconds digit has changed
+    _secondsPreloaded = false;
+#endif
 }
 
 static inline uint8_t is_display_pending()
 {
     // See set_display_pending_flag for what's going on here
-    return DDRB & _BV(PB5);
+    return REG_READ(DDRB) & _BV(PB5);
 }
 
 static inline void clear_display_pending_flag()
 {
     // See set_display_pending_flag for what's going on here
-    DDRB &= ~_BV(PB5);
+    REG_CLEAR(DDRB, _BV(PB5));
 }
 
 
@@ -189,36 +641,56 @@ static inline void set_timepulse_seen_flag()
 {
     // Re-purpose an unused register for single instruction set/clear
     // This "input buffer disable register" bit isn't functional as PB0 is always an output
-    DIDR0 |= _BV(AIN0D);
+    REG_SET(DIDR0, _BV(AIN0D));
 }
 
 static inline uint8_t has_seen_timepulse()
 {
     // See set_timepulse_seen_flag for what's going on here
-    return DIDR0 & _BV(AIN0D);
+    return REG_READ(DIDR0) & _BV(AIN0D);
 }
 
 static inline void clear_timepulse_seen_flag()
 {
     // See set_timepulse_seen_flag for what's going on here
-    DIDR0 &= ~_BV(AIN0D);
+    REG_CLEAR(DIDR0, _BV(AIN0D));
 }
 
 
 static inline void display_buffer_set(uint8_t index, uint8_t value)
 {
+#if kNumChips > 1
+    if (_display_buf[index] != value) {
+        _display_buf[index] = value;
+
+        // Mark for sending with the next update
+        _display_clean[index / kChipDigits] &= ~_BV(index % kChipDigits);
+    }
+#else
     _display_buf[index] = value;
+#endif
 }
 
 /**
  * Send the current time to the MAX7219 as 6 BCD digits
+ *
+ * With a chain of MAX7219s, the date is also sent to the second chip as DD-MM-YY
  */
 static void display_buffer_update(GpsTime* now)
 {
     // Send time to display
     uint8_t digit = 0;
 
+#if kNumChips > 1
+    for (int8_t i = 0; i < 6; ++i) {
+
+        // Date fields start on the second chip
+        if (i == 3) {
+            digit = kChipDigits;
+        }
+#else
     for (int8_t i = 0; i < 3; ++i) {
+#endif
 
         // Manually digit into tens and ones columns
         // This saves 25 bytes vs. using the divide and modulo operators.
@@ -232,15 +704,65 @@ static void display_buffer_update(GpsTime* now)
 
         display_buffer_set(digit++, tens);
         display_buffer_set(digit++, ones);
+
+#if kNumChips > 1
+        // Separate the day, month and year
+        if (i == 3 || i == 4) {
+            display_buffer_set(digit++, 10 /* - */);
+        }
+#endif
     }
 }
 
-static void display_buffer_send()
+/**
+ * Send changed digits to the display, starting with the seconds
+ *
+ * If yieldToUart is set, this stops between digits once the GPS starts sending a byte so the
+ * soft UART doesn't miss its start bit. Returns false if any digits were left unsent.
+ */
+static bool display_buffer_send_digits(bool yieldToUart)
 {
+#if kNumChips > 1
+    for (int8_t i = kChipDigits; i != 0; --i) {
+        if (yieldToUart && (REG_READ(PINB) & _BV(PIN_SOFT_RX)) == 0) {
+            return false;
+        }
+
+        const uint8_t bit = _BV(i - 1);
+        uint8_t chipMask = 0;
+
+        // Collect the chips where this digit has changed
+        for (int8_t chip = kNumChips - 1; chip >= 0; --chip) {
+            chipMask <<= 1;
+
+            if ((_display_clean[chip] & bit) == 0) {
+                _display_clean[chip] |= bit;
+                chipMask |= 1;
+            }
+        }
+
+        // Send the digit to all chips that need it in one LOAD cycle
+        if (chipMask != 0) {
+            max7219_cmd_chain(i, &_display_buf[i-1], chipMask);
+        }
+    }
+#else
     for (int8_t i = kNumDigits; i != 0; --i) {
+        if (yieldToUart && (REG_READ(PINB) & _BV(PIN_SOFT_RX)) == 0) {
+            return false;
+        }
+
         // Send buffer values to 1-indexed digit addresses
         max7219_cmd(i, _display_buf[i-1]);
     }
+#endif
+
+    return true;
+}
+
+static inline void display_buffer_send()
+{
+    display_buffer_send_digits(false);
 }
 
 /**
@@ -249,8 +771,8 @@ static void display_buffer_send()
 static void display_clear()
 {
     // Reverse loop to save an instruction as the order doesn't matter
-    for (int8_t i = kNumDigits - 1; i >= 0; --i) {
-        _display_buf[i] = 0x7F;
+    for (int8_t i = (kNumChips * kChipDigits) - 1; i >= 0; --i) {
+        display_buffer_set(i, 0x7F);
     }
 }
 
@@ -332,6 +854,9 @@ void increment_time(GpsTime* tim)
 
     if (tim->hour == 24) {
         tim->hour = 0;
+#if kNumChips > 1
+        increment_date(tim);
+#endif
     }
 }
 
@@ -345,6 +870,25 @@ static void restore_timezone()
     }
 }
 
+// Weight of each new LDR reading in the moving average, as a shift (1/8)
+// This settles about as fast as a straight average over 16 readings
+#define kLightFilterShift 3
+
+// Readings the average has to move past a brightness table entry to change the intensity
+#define kBrightnessHysteresis 3
+
+// Exponential moving average of the LDR readings, scaled up by 1 << kLightFilterShift
+static uint16_t _lightFiltered = 0;
+
+// Intensity last written to the MAX7219, which starts at its minimum on power-up
+static uint8_t _intensity = 0;
+
+/**
+ * Smooth the LDR reading and set the display intensity when it crosses a brightness level
+ *
+ * The intensity is only written when the average moves more than kBrightnessHysteresis past
+ * the level boundary, so noise on a reading close to a boundary doesn't resend it.
+ */
 static void display_adjust_brightness(const uint8_t reading)
 {
     // Map of brightness (index) to minimum ADC reading to trigger
@@ -367,192 +911,1190 @@ static void display_adjust_brightness(const uint8_t reading)
         230, // 96% duty cycle
     };
 
-    // State to obtain an average of LDR readings
-    // The size of this array should  be a power of two
-    static uint8_t averageBuffer[16] = {};
-    static uint8_t writeIndex = 0;
-    static uint16_t runningTotal = 0;
-
-    // Adjust running total with the new value
-    runningTotal -= averageBuffer[writeIndex];
-    runningTotal += reading;
+    // Move the average 1/8 of the way towards the new reading
+    _lightFiltered += reading - (_lightFiltered >> kLightFilterShift);
 
-    // Append new reading
-    averageBuffer[writeIndex] = reading;
-    writeIndex = (writeIndex + 1) % sizeof(averageBuffer);
+    const uint8_t average = _lightFiltered >> kLightFilterShift;
 
-    const uint8_t average = runningTotal/sizeof(averageBuffer);
+    uint8_t intensity = _intensity;
 
-    uint8_t intensity = 0;
-    while (intensity < sizeof(brightnessTable) && brightnessTable[intensity] < average) {
+    while (intensity < sizeof(brightnessTable)
+            && average > brightnessTable[intensity] + kBrightnessHysteresis) {
         ++intensity;
     }
 
+    while (intensity > 0 && average + kBrightnessHysteresis < brightnessTable[intensity - 1]) {
+        --intensity;
+    }
+
     // Set brightness
-    max7219_cmd(0x0A, intensity);
+    if (intensity != _intensity) {
+        max7219_cmd(0x0A, intensity);
+        _intensity = intensity;
+    }
+
+#ifdef ENABLE_DARK_SHUTDOWN
+    static bool isShutdown = false;
+
+    // Turn the display off while the room is dark
+    // Digits are still sent while shut down, so the current time is showing as soon as the
+    // display is enabled again. The average settles within ~24 readings (~650ms at 9.6MHz) of
+    // the light returning, which is inside one timepulse.
+    if (average < DARK_SHUTDOWN_LEVEL) {
+        if (!isShutdown) {
+            max7219_cmd(0x0C, 0);
+            isShutdown = true;
+        }
+    } else if (average > DARK_WAKE_LEVEL) {
+        if (isShutdown) {
+            max7219_cmd(0x0C, 1);
+            isShutdown = false;
+        }
+    }
+#endif
 }
 
-static bool wait_for_timepulse()
+#ifdef ENABLE_TIMEBASE
+// The overflow interrupt clears TOV0, so compare against the overflow count instead
+static uint8_t _lastTimerOverflow = 0;
+
+static inline bool timer_has_overflowed()
 {
-    // Switch LOAD/CS pin to input with pull-up
-    // The timepulse signal is wired to pull this line low
-    DDRB &= ~_BV(PIN_LOAD);
+    return _timerOverflows != _lastTimerOverflow;
+}
 
-    // Clear pin change flag
-    GIFR |= _BV(PCIF);
+static inline void timer_reset_overflow()
+{
+    _lastTimerOverflow = _timerOverflows;
+}
+#else
+static inline bool timer_has_overflowed()
+{
+    return REG_READ(TIFR0) & _BV(TOV0);
+}
 
-    // Wait for a UART or Timepulse to change - whichever comes first
-    while ((GIFR & _BV(PCIF)) == 0);
+static inline void timer_reset_overflow()
+{
+    REG_WRITE(TIFR0, 0xFF); // Clear all TIM0 interrupt flags
+}
+#endif
+
+#ifdef ENABLE_TELEMETRY
+#include "telemetry.h"
+
+static struct {
+    uint8_t sequence;
+    uint8_t checksumFailures;
+    uint16_t timepulseTime;
+    uint16_t loopStart;
+    uint16_t loopMax;
+    uint16_t ppsOffset;
+    bool sawTimepulse;
+    bool recordPending;
+
+#ifdef ENABLE_SLEEP
+    uint16_t sleepTicks;
+#endif
+} _telemetry;
+
+static inline void telemetry_loop_start()
+{
+    const uint16_t now = timebase_now();
+    const uint16_t elapsed = now - _telemetry.loopStart;
 
-    // Check if the timepulse caused the pin change flag
-    bool is_timepulse = (PINB & _BV(PIN_LOAD)) == 0;
+    if (elapsed > _telemetry.loopMax) {
+        _telemetry.loopMax = elapsed;
+    }
 
-    // Set LOAD/CS back to output idling high
-    DDRB |= _BV(PIN_LOAD);
+    _telemetry.loopStart = now;
+}
 
-    return is_timepulse;
+static inline void telemetry_timepulse()
+{
+    _telemetry.timepulseTime = timebase_now();
+    _telemetry.sawTimepulse = true;
 }
 
-static inline bool timer_has_overflowed()
+/**
+ * Queue a record for the RMC sentence that just ended, to be sent in the quiet gap
+ *
+ * Sending it straight away would take ~2300 cycles out of the gap before the next sentence.
+ */
+static inline void telemetry_rmc()
 {
-    return TIFR0 & _BV(TOV0);
+    _telemetry.ppsOffset = 0xFFFF;
+
+    if (_telemetry.sawTimepulse) {
+        _telemetry.ppsOffset = timebase_now() - _telemetry.timepulseTime;
+    }
+
+    _telemetry.sawTimepulse = false;
+    _telemetry.recordPending = true;
 }
 
-static inline void timer_reset_overflow()
+/**
+ * Clock out the queued telemetry record on the MAX7219 lines (see telemetry.h for the format)
+ *
+ * LOAD must be held high so the MAX7219 doesn't latch any of it. Every word is a no-op
+ * to the MAX7219, so a timepulse latching the shift register afterwards is harmless.
+ */
+static void telemetry_send_record()
 {
-    TIFR0 = 0xFF; // Clear all TIM0 interrupt flags
+    const uint8_t fields[] = {
+        _telemetry.sequence++,
+        kGPS_Success,
+        _telemetry.checksumFailures,
+        _telemetry.ppsOffset,
+        _telemetry.ppsOffset >> 8,
+        _telemetry.loopMax,
+        _telemetry.loopMax >> 8,
+        _deferredOverruns,
+#ifdef ENABLE_SLEEP
+        _telemetry.sleepTicks,
+        _telemetry.sleepTicks >> 8,
+#else
+        0,
+        0,
+#endif
+    };
+
+    uint8_t checksum = 0;
+
+    load_acquire();
+
+    // Fields are in tag order after the start word
+    for (uint8_t i = 0; i <= sizeof(fields); ++i) {
+        uint16_t word = TELEMETRY_WORD(kTelemetry_Checksum, checksum);
+
+        if (i != sizeof(fields)) {
+            word = TELEMETRY_WORD(i == 0 ? kTelemetry_Start : i, fields[i]);
+            checksum += fields[i];
+        }
+
+#ifdef ENABLE_PPS_INTERRUPT
+        // The timepulse interrupt drives LOAD on PORTB too: keep it out of each word, as
+        // ENABLE_SPI_UNROLLED writes PORTB back from a copy
+        cli();
+#endif
+
+        spi_send_16(word);
+
+#ifdef ENABLE_PPS_INTERRUPT
+        sei();
+#endif
+    }
+
+    load_release();
+
+    _telemetry.loopMax = 0;
+    _telemetry.recordPending = false;
+
+#ifdef ENABLE_SLEEP
+    _telemetry.sleepTicks = 0;
+#endif
 }
+#endif
 
-int main(void)
+#ifdef ENABLE_HOLDOVER
+// Timer0 ticks per second if the RC oscillator ran at exactly F_CPU
+#define kNominalTicksPerSecond (F_CPU / TIMER0_PRESCALER)
+
+// Software clock that keeps time from Timer0 while the timepulse is missing
+static struct {
+    // Learned Timer0 ticks between timepulses
+    uint16_t ticksPerSecond;
+
+    // Time of the last timepulse from timebase_now()
+    uint16_t lastTimepulse;
+
+    // Local time currently displayed, or pending for the next second
+    GpsTime time;
+
+    // Consecutive timepulses that were about a second apart (wraps)
+    uint8_t goodPulses;
+
+    // Value of ticksPerSecond in EEPROM, or being written to it
+    // Kept here so the timepulse doesn't read the EEPROM while a write may be starting
+    uint16_t savedTicks;
+
+    // Number of bytes of savedTicks still to write to EEPROM
+    uint8_t saveBytes;
+
+    bool learned;
+    bool timeValid;
+
+    // Set while the displayed time is coming from the software clock
+    bool active;
+} _holdover;
+
+// Ticks since the start of the current second, as of the last Timer0 overflow
+static volatile int16_t _holdoverTicks = 0;
+
+// Set by the overflow interrupt when a second passes without a timepulse
+static volatile bool _holdoverSecond = false;
+
+static uint16_t holdover_read_ticks()
 {
-    // Flag state changes on the UART and Timepulse pins
-    // Interrupts aren't used, but the interrupt flags are read
-    PCMSK = _BV(PIN_SOFT_RX) | _BV(PIN_LOAD);
+    return unchecked_eeprom_read(EEPROM_TICKS_PER_SECOND_ADDR)
+        | (unchecked_eeprom_read(EEPROM_TICKS_PER_SECOND_ADDR + 1) << 8);
+}
 
-    setup_pins();
-    setup_adc();
-    setup_timer();
+static inline bool holdover_is_plausible(uint16_t ticks)
+{
+    // The internal oscillator is factory calibrated to within 10%
+    return ticks > (kNominalTicksPerSecond - kNominalTicksPerSecond/8)
+        && ticks < (kNominalTicksPerSecond + kNominalTicksPerSecond/8);
+}
 
-    max7219_init();
+static void holdover_restore()
+{
+    const uint16_t ticks = holdover_read_ticks();
+    _holdover.savedTicks = ticks;
 
-    restore_timezone();
+    if (holdover_is_plausible(ticks)) {
+        _holdover.ticksPerSecond = ticks;
+        _holdover.learned = true;
+    } else {
+        _holdover.ticksPerSecond = kNominalTicksPerSecond;
+    }
+}
 
-    while (true) {
+/**
+ * Write the learned ticks per second to EEPROM, one byte per call
+ *
+ * This never waits on the EEPROM: a byte is skipped until the previous write finishes.
+ */
+static inline void holdover_save_step()
+{
+    // Hold off the timepulse, which can start the save over with a new value
+    const uint8_t sreg = REG_READ(SREG);
+    cli();
 
-        // Update brightness if the timer has overflowed
-        if (timer_has_overflowed()) {
-            timer_reset_overflow();
+    if (_holdover.saveBytes != 0 && (REG_READ(EECR) & _BV(EEPE)) == 0) {
+        const uint8_t index = _holdover.saveBytes - 1;
 
-            const uint8_t reading = ADCH;
-            uint8_t numReads = 0;
+        unchecked_eeprom_write(
+            EEPROM_TICKS_PER_SECOND_ADDR + index,
+            ((uint8_t*) &_holdover.savedTicks)[index]
+        );
 
-            // The 200mV offset prevents the LDR output dropping below around 10 in an 8-bit reading
-            // When the button is pressed the reading should drop to zero.
-            const uint8_t buttonThreshold = 8;
+        // Only count the byte as saved once its write has started
+        _holdover.saveBytes = index;
+    }
+
+    REG_WRITE(SREG, sreg);
+}
+
+static inline bool holdover_is_ready()
+{
+    return _holdover.learned && _holdover.timeValid;
+}
 
-            if (reading < buttonThreshold) {
-                const int8_t oldTimezone = _timezoneOffset;
+/**
+ * Remember the time prepared from an RMC sentence for use if the timepulse goes missing
+ */
+static inline void holdover_set_time(GpsTime* now)
+{
+    _holdover.time = *now;
+    _holdover.timeValid = true;
+}
 
-                while (ADCH < buttonThreshold) {
-                    ++numReads;
+/**
+ * Discipline the software clock against a timepulse
+ *
+ * Called at the timepulse, before the display is sent.
+ */
+static void holdover_timepulse()
+{
+    const uint8_t sreg = REG_READ(SREG);
+    cli();
 
-                    // Require the reading to stay below the threshold for a series of readings
-                    // (During real world use the ADC reading was occasionally dipping below the
-                    // threshold without a button press, causing the timezone to increment unexpectedly.
-                    if (numReads <= 15) {
-                        while (!timer_has_overflowed()); // Delay for ~27ms
-                        timer_reset_overflow();
-                        continue;
-                    }
+    const uint16_t now = timebase_now();
+    const uint16_t interval = now - _holdover.lastTimepulse;
+    const int16_t sinceSecond = _holdoverTicks + (uint8_t) now;
 
-                    // Reset period counter
-                    numReads = 0;
+    _holdover.lastTimepulse = now;
 
-                    // Update timezone
-                    increment_timezone();
-                    display_timezone();
-                    display_buffer_send();
-                }
+    // Count software seconds from this pulse
+    _holdoverTicks = -(int16_t) (uint8_t) now;
 
-                // Persist the timezone if it was changed
-                if (oldTimezone != _timezoneOffset) {
-                    unchecked_eeprom_write(EEPROM_TIMEZONE_ADDR, _timezoneOffset);
-                }
+    if (_holdover.active) {
+        _holdover.active = false;
 
-            } else {
-                // Update the display brightness for the ambient light level
-                display_adjust_brightness(reading);
+        // Show the second starting with this pulse, unless the software clock has just shown it
+        // This also removes the holdover indicator
+        if (!is_display_pending()) {
+            if (sinceSecond > (int16_t) (_holdover.ticksPerSecond / 2)) {
+                increment_time(&_holdover.time);
             }
+
+            display_buffer_update(&_holdover.time);
         }
+    }
 
-        // Wait for timepulse or UART message
-        if (wait_for_timepulse()) {
-            // Saw a timepulse signal - update the display immediately
-            display_buffer_send();
+    // Learn the oscillator speed from pulses that arrived about a second apart
+    // Stepping by one tick at a time stops a late detected pulse from skewing the result
+    if (holdover_is_plausible(interval)) {
+        uint16_t ticks = _holdover.ticksPerSecond;
+
+        if (!_holdover.learned) {
+            ticks = interval;
+            _holdover.learned = true;
+        } else if (interval > ticks) {
+            ++ticks;
+        } else if (interval < ticks) {
+            --ticks;
+        }
 
-            set_timepulse_seen_flag();
-            clear_display_pending_flag();
+        _holdover.ticksPerSecond = ticks;
+
+        // Every few minutes of good pulses, save the learned value if it has changed
+        if (++_holdover.goodPulses == 0 && ticks != _holdover.savedTicks) {
+            _holdover.savedTicks = ticks;
+            _holdover.saveBytes = 2;
         }
+    } else {
+        _holdover.goodPulses = 0;
+    }
 
-        // Wait for a line of text from the GPS unit
-        GpsReadStatus status = gps_read_time(&_gpsTime);
+    REG_WRITE(SREG, sreg);
+}
 
-        // Handle the processed message from the GPS module
-        // This is done last as it blocks to sync with the timepulse signal
-        switch (status) {
-            case kGPS_Success: {
+/**
+ * Advance the display by a second from the software clock
+ */
+static void holdover_second()
+{
+    _holdover.active = true;
+
+    // The time may already be prepared for the pulse that didn't arrive
+    if (!is_display_pending()) {
+        increment_time(&_holdover.time);
+    }
+
+    clear_display_pending_flag();
+
+    display_buffer_update(&_holdover.time);
+
+    // Indicate holdover with the decimal point after the hours
+    display_buffer_set(1, _display_buf[1] | 0x80);
+}
+#endif
 
-                // Update the display with the new parsed time
-                apply_timezone_offset(&_gpsTime);
+#ifdef ENABLE_PPS_STATS
+// Ticks a UART byte takes to arrive, rounded up
+#define kUartByteTicks (((10UL * F_CPU) / BAUD / TIMER0_PRESCALER) + 1)
 
-                if (is_display_pending()) {
-                    // Display was pending but we saw another RMC message
-                    // This means a timepulse was expected but didn't happen
-                    clear_timepulse_seen_flag();
-                    clear_display_pending_flag();
-                }
+#define kNumStatsPages 7
 
-                if (has_seen_timepulse()) {
-                    // If preparing the display for the next second, the time needs to be incremented
-                    increment_time(&_gpsTime);
-                }
+typedef struct TimingStat {
+    // Stored inverted so the zeroed state at start-up has no minimum
+    uint16_t invertedMin;
+    uint16_t max;
 
-                display_buffer_update(&_gpsTime);
+    // Exponential moving average over roughly the last 16 samples
+    uint16_t mean;
+} TimingStat;
 
-                if (has_seen_timepulse()) {
-                    // Don't update the display yet - wait for the next timepulse
-                    set_display_pending_flag();
-                    continue;
+// Timing statistics in Timer0 ticks
+// The order of the fields matches the diagnostic pages
+static struct {
+    // Timepulse edge to the end of the '$' starting the next RMC sentence
+    TimingStat rmcOffset;
 
-                } else {
+    // Timepulse edge to the last digit being latched by the timepulse interrupt
+    TimingStat loadLatency;
 
-                    // Flag that display is not synced to timepulse by illuminating the last decimal point
-                    _display_buf[kNumDigits - 1] |= 0x80;
-                    break;
-                }
+    // RMC sentences with time information that weren't preceded by a timepulse
+    uint16_t missedPulses;
+
+    uint16_t timepulseTime;
+    uint16_t sentenceTime;
+    bool sawTimepulse;
+} _stats;
+
+// Diagnostic page being displayed, or zero when showing the time
+static uint8_t _diagPage = 0;
+
+static void stat_add(TimingStat* stat, uint16_t value)
+{
+    if (stat->invertedMin == 0) {
+        // First sample
+        stat->mean = value;
+    } else {
+        stat->mean += ((int16_t) (value - stat->mean)) >> 4;
+    }
+
+    if ((uint16_t) ~value > stat->invertedMin) {
+        stat->invertedMin = ~value;
+    }
+
+    if (value > stat->max) {
+        stat->max = value;
+    }
+}
+
+static inline void stats_sentence_start()
+{
+    _stats.sentenceTime = timebase_now();
+}
+
+/**
+ * Record a timepulse and return the time of its edge
+ *
+ * The interrupt is held off while the soft UART reads a byte. If this runs within a byte
+ * time of a start bit, the edge is taken to be at the start bit. This makes the latency an
+ * upper bound, off by at most a byte (~10 ticks).
+ */
+static uint16_t stats_timepulse()
+{
+    uint16_t edge = timebase_now();
+    const uint8_t sinceByteStart = (uint8_t) edge - _uartByteStart;
+
+    if (sinceByteStart <= kUartByteTicks) {
+        edge -= sinceByteStart;
+    }
+
+    _stats.timepulseTime = edge;
+    _stats.sawTimepulse = true;
+
+    return edge;
+}
+
+/**
+ * Record the RMC sentence that was just read with time information
+ */
+static void stats_rmc()
+{
+    if (_stats.sawTimepulse) {
+        stat_add(&_stats.rmcOffset, _stats.sentenceTime - _stats.timepulseTime);
+    } else if (_stats.rmcOffset.max != 0) {
+        // Only count missing pulses once they've been seen since start-up
+        ++_stats.missedPulses;
+    }
+
+    _stats.sawTimepulse = false;
+}
+
+/**
+ * Show the current diagnostic page as the page number followed by a five digit value
+ */
+static void display_stats_page()
+{
+    static const __flash uint16_t powersOfTen[] = {10000, 1000, 100, 10, 1};
+
+    uint16_t value = ((uint16_t*) &_stats)[_diagPage - 1];
+
+    // Minimums are stored inverted
+    if (_diagPage == 1 || _diagPage == 4) {
+        value = ~value;
+    }
+
+    display_clear();
+    display_buffer_set(0, _diagPage | 0x80);
+
+    // Split into decimal digits manually to save code size
+    for (uint8_t i = 0; i < 5; ++i) {
+        uint8_t digit = 0;
+
+        while (value >= powersOfTen[i]) {
+            value -= powersOfTen[i];
+            ++digit;
+        }
+
+        display_buffer_set(i + 1, digit);
+    }
+}
+
+static void display_next_stats_page()
+{
+    ++_diagPage;
+
+    if (_diagPage > kNumStatsPages) {
+        // Back to the clock, which shows again with the next sentence
+        _diagPage = 0;
+        display_clear();
+    } else {
+        display_stats_page();
+    }
+}
+#endif
+
+// Set when a display update gave way to the UART before sending every digit
+static volatile bool _displayIncomplete = false;
+
+#ifdef ENABLE_PPS_LATCH
+// Set when an RMC sentence for the next timepulse arrived while _displayIncomplete was set
+static bool _gpsTimeQueued = false;
+#endif
+
+#ifdef ENABLE_PPS_LATCH
+/**
+ * Shift the pending seconds digit into the MAX7219 without latching it
+ *
+ * The MAX7219 clocks in data regardless of the state of LOAD and only latches its shift
+ * register on the rising edge of LOAD. As the timepulse pulls LOAD low, the digit is latched
+ * in hardware the moment the timepulse releases the line, with no software latency.
+ *
+ * This must be the last thing clocked out before the timepulse releases LOAD.
+ */
+static inline void display_preload_seconds()
+{
+    // Further chips in the chain are given a no-op so they aren't changed by the latch
+    for (uint8_t i = kNumChips - 1; i != 0; --i) {
+        spi_send_16(0x0000);
+    }
+
+    spi_send_16((kNumDigits << 8) | _display_buf[kNumDigits - 1]);
+    _secondsPreloaded = true;
+}
+#endif
+
+/**
+ * Leave the pending seconds digit for the next timepulse to latch
+ *
+ * This needs to be called after anything else is clocked out while the display is pending.
+ * It only clocks the digit out again when something has replaced it, as a start bit that
+ * arrives meanwhile is seen late.
+ */
+static inline void display_prepare_latch()
+{
+#ifdef ENABLE_PPS_LATCH
+    // Anything else left in the shift register is a copy of the last command sent, so
+    // latching it again when there is nothing pending is harmless.
+    if (is_display_pending() && !_secondsPreloaded) {
+        display_preload_seconds();
+    }
+#endif
+}
+
+/**
+ * Update the display as soon as the timepulse pulls LOAD low
+ *
+ * This is called for every change on LOAD, from the pin change interrupt or polled by the
+ * scheduler. It can run part way through a sentence, between bytes: the soft UART holds
+ * interrupts off while it reads each byte. The seconds are sent first, and the remaining
+ * digits are left for the scheduler if the next byte starts arriving in the meantime.
+ * With ENABLE_PPS_LATCH the seconds are already showing, so all of the digits are left for
+ * the scheduler to send once the GPS isn't sending (see kLatchQuietTicks).
+ */
+static void timepulse_handle_edge()
+{
+    const bool lineLow = (REG_READ(PINB) & _BV(PIN_LOAD)) == 0;
+
+#ifdef ENABLE_PPS_LATCH
+    // The preloaded seconds digit is latched in hardware when the timepulse releases LOAD
+    // Handle the pulse on that edge so the rest of the display changes together with it
+    const bool isTimepulse = !lineLow && _timepulseActive;
+#else
+    const bool isTimepulse = lineLow && !_timepulseActive;
+#endif
+
+    if (isTimepulse) {
+#ifdef ENABLE_PPS_STATS
+        const uint16_t edge = stats_timepulse();
+#endif
+
+#ifdef ENABLE_TELEMETRY
+        telemetry_timepulse();
+#endif
+
+#ifdef ENABLE_HOLDOVER
+        holdover_timepulse();
+#endif
+
+#ifdef ENABLE_PPS_LATCH
+        // The GPS may be part way through a sentence by the end of the pulse
+        _displayIncomplete = true;
+#else
+        _displayIncomplete = !display_buffer_send_digits(true);
+#endif
+
+#ifdef ENABLE_PPS_STATS
+        if (!_displayIncomplete) {
+            stat_add(&_stats.loadLatency, timebase_now() - edge);
+        }
+#endif
+
+        set_timepulse_seen_flag();
+        clear_display_pending_flag();
+    }
+
+    // The GPS sends this second's sentences after the timepulse starts, which closes the gap
+    if (lineLow && !_timepulseActive) {
+        _quietTicks = 0;
+        _burstDone = false;
+    }
+
+    _timepulseActive = lineLow;
+}
+
+#ifdef ENABLE_PPS_INTERRUPT
+ISR(PCINT0_vect)
+{
+    hal_task_start(Timepulse);
+    timepulse_handle_edge();
+    hal_task_end(Timepulse);
+}
+#endif
+
+#ifdef ENABLE_TIMEBASE
+ISR(TIM0_OVF_vect)
+{
+    ++_timerOverflows;
+
+#ifdef ENABLE_HOLDOVER
+    _holdoverTicks += 256;
+
+    // A second has passed without a timepulse once the learned number of ticks is reached
+    // The first missing pulse is given an extra 1/8 second to arrive
+    uint16_t threshold = _holdover.ticksPerSecond;
+
+    if (!_holdover.active) {
+        threshold += threshold / 8;
+    }
+
+    if (_holdoverTicks >= (int16_t) threshold) {
+        _holdoverTicks -= _holdover.ticksPerSecond;
+
+#ifdef ENABLE_PPS_INTERRUPT
+        // Update the display from here like the timepulse interrupt does
+        if (holdover_is_ready()) {
+            holdover_second();
+            _displayIncomplete = !display_buffer_send_digits(true);
+        }
+#else
+        _holdoverSecond = true;
+#endif
+    }
+#endif
+}
+#endif
+
+/*
+ * Tasks run by the scheduler in main(), highest priority first
+ *
+ * Each task runs to completion and the scheduler starts again from the top after any task
+ * has run. Worst-case execution times (WCET) are calculated for 9.6MHz, one MAX7219 and the
+ * C SPI loop, and checked against the host backend's cycle stamps by the scheduler test (see
+ * the README). ENABLE_TELEMETRY measures the longest pass through the scheduler in the field.
+ */
+
+// State of the sentence being read from the GPS
+static GpsParser _gpsParser;
+
+/**
+ * Timepulse: handle changes on LOAD, then finish display updates that gave way to the UART
+ *
+ * With ENABLE_PPS_LATCH the update waits for a pause in the GPS sentences, as the timepulse
+ * ends ~100ms into the second, where the GPS may already be sending.
+ *
+ * WCET ~0.17ms, sending all six digits. Returns true if there was anything to do.
+ */
+static inline bool task_timepulse()
+{
+#ifndef ENABLE_PPS_INTERRUPT
+    // The pin change flag is polled instead of running the interrupt
+    if (REG_READ(GIFR) & _BV(PCIF)) {
+        REG_WRITE(GIFR, _BV(PCIF));
+        timepulse_handle_edge();
+        return true;
+    }
+
+#ifdef ENABLE_HOLDOVER
+    // A second passed without a timepulse
+    if (_holdoverSecond) {
+        _holdoverSecond = false;
+
+        if (holdover_is_ready()) {
+            holdover_second();
+            _displayIncomplete = true;
+        }
+
+        return true;
+    }
+#endif
+#endif
+
+    // Only send once the UART is quiet, or this would give way again straight away
+    if (_displayIncomplete && (REG_READ(PINB) & _BV(PIN_SOFT_RX)) != 0) {
+#ifdef ENABLE_PPS_LATCH
+        // The seconds are already showing, so wait for the GPS to pause between bursts
+        if (_quietTicks < kLatchQuietTicks) {
+            return false;
+        }
+#endif
+
+        _displayIncomplete = !display_buffer_send_digits(true);
+
+#ifdef ENABLE_PPS_LATCH
+        // The buffer can now move on to the time for the next timepulse
+        if (!_displayIncomplete && _gpsTimeQueued) {
+            _gpsTimeQueued = false;
+            display_buffer_update(&_gpsTime);
+            set_display_pending_flag();
+            display_prepare_latch();
+        }
+#endif
+
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Act on a complete sentence from the GPS
+ */
+static void handle_sentence(GpsReadStatus status)
+{
+#ifdef ENABLE_TELEMETRY
+    // Report once per second on the RMC sentence, after the GPS has finished sending
+    if (status == kGPS_Success) {
+        telemetry_rmc();
+    } else if (status == kGPS_InvalidChecksum) {
+        ++_telemetry.checksumFailures;
+    }
+#endif
+
+#ifdef ENABLE_PPS_STATS
+    if (status == kGPS_Success) {
+        stats_rmc();
+    }
+
+    // Refresh the diagnostics once per second instead of showing the time
+    if (_diagPage != 0) {
+        if (status != kGPS_NoMatch) {
+            display_stats_page();
+            display_buffer_send();
+        }
+
+        return;
+    }
+#endif
+
+#ifdef ENABLE_HOLDOVER
+    // Keep showing the software clock rather than signal or error indicators
+    if (_holdover.active && status != kGPS_Success) {
+        return;
+    }
+#endif
+
+    switch (status) {
+        case kGPS_Success: {
+
+            // Update the display with the new parsed time
+            apply_timezone_offset(&_gpsTime);
+
+            if (is_display_pending()) {
+                // Display was pending but we saw another RMC message
+                // This means a timepulse was expected but didn't happen
+                clear_timepulse_seen_flag();
+                clear_display_pending_flag();
             }
 
-            case kGPS_NoMatch:
-                // Ignore partial and unknown sentences
-                continue;
+#ifdef ENABLE_PPS_LATCH
+            // A sentence that completes while the timepulse still holds LOAD low is for the
+            // second that pulse starts, which is only latched once LOAD is released
+            const bool forNextSecond = has_seen_timepulse() && (REG_READ(PINB) & _BV(PIN_LOAD)) != 0;
+#else
+            const bool forNextSecond = has_seen_timepulse();
+#endif
+
+            if (forNextSecond) {
+                // If preparing the display for the next second, the time needs to be incremented
+                increment_time(&_gpsTime);
+            }
 
-            case kGPS_NoSignal:
-                // Walk the decimal point across the display to indicate activity
-                display_no_signal();
-                break;
+#ifdef ENABLE_HOLDOVER
+            holdover_set_time(&_gpsTime);
+#endif
 
-            case kGPS_InvalidChecksum:
-                display_error_code(1);
-                break;
+#ifdef ENABLE_PPS_LATCH
+            // The buffer still holds the digits for the second that has just started until
+            // task_timepulse() has sent them, which then moves it on to this time
+            if (_displayIncomplete && has_seen_timepulse()) {
+                _gpsTimeQueued = true;
+                return;
+            }
+#endif
+
+            display_buffer_update(&_gpsTime);
+
+            if (has_seen_timepulse()) {
+                // Don't update the display yet - wait for the next timepulse
+                set_display_pending_flag();
+                display_prepare_latch();
+                return;
+
+            } else {
 
-            case kGPS_BadFormat:
-                // This state is returned if the UART line isn't pulled high (ie. GPS unplugged)
-                display_error_code(2);
+                // Flag that display is not synced to timepulse by illuminating the last decimal point
+                display_buffer_set(kNumDigits - 1, _display_buf[kNumDigits - 1] | 0x80);
                 break;
+            }
+        }
+
+        case kGPS_NoMatch:
+            // Ignore partial and unknown sentences
+            return;
+
+        case kGPS_NoSignal:
+            // Walk the decimal point across the display to indicate activity
+            display_no_signal();
+            break;
+
+        case kGPS_InvalidChecksum:
+            display_error_code(1);
+            break;
+
+        case kGPS_BadFormat:
+            // This state is returned if the UART line isn't pulled high (ie. GPS unplugged)
+            display_error_code(2);
+            break;
+
+        default:
+            break;
+    }
+
+    // Push buffer to the display
+    display_buffer_send();
+}
+
+/**
+ * UART byte: feed the byte whose start bit has arrived to the sentence parser
+ *
+ * WCET ~1.4ms: ~1ms receiving the byte, then up to ~0.4ms handling a complete sentence that
+ * sends the display. Telemetry records are sent later, by task_deferred().
+ */
+static inline void task_uart_byte(const uint8_t byte)
+{
+    const GpsReadStatus status = gps_parse_byte(&_gpsParser, &_gpsTime, byte);
+    _quietTicks = 0;
+
+    if (status != kGPS_InProgress) {
+        // Anything but NoMatch is the end of the RMC, the last sentence the gap waits for
+        if (status != kGPS_NoMatch) {
+            _burstDone = true;
+        }
+
+#ifdef ENABLE_PPS_LATCH
+        // The timepulse may have released LOAD while the last byte was read: handle that first,
+        // as the sentence is matched to a second by whether it ended before or after it
+        if (REG_READ(GIFR) & _BV(PCIF)) {
+            REG_WRITE(GIFR, _BV(PCIF));
+            timepulse_handle_edge();
+        }
+#endif
+
+#ifdef ENABLE_PPS_INTERRUPT
+        // Hold the timepulse off while the display buffer and flags are updated
+        cli();
+#endif
+
+        handle_sentence(status);
+
+#ifdef ENABLE_PPS_INTERRUPT
+        sei();
+#endif
+    }
+}
+
+/**
+ * Whether the GPS has finished sending for this second
+ *
+ * The gap opens kQuietGapTicks after the last byte once this second's RMC has ended, and
+ * closes when the next timepulse starts. With no GPS sentences at all it opens after
+ * kQuietIdleTicks instead.
+ */
+static inline bool is_quiet_gap(void)
+{
+    const uint8_t ticks = _quietTicks;
+
+    return (_burstDone && ticks >= kQuietGapTicks) || ticks >= kQuietIdleTicks;
+}
+
+/**
+ * Deferred: non-urgent work that can wait for the quiet part of the second
+ *
+ * This runs on timer overflows in the quiet gap (see is_quiet_gap()), which is after the GPS
+ * has finished sending its sentences and before the next timepulse. Clocking
+ * data out to the display or starting an EEPROM write then can't delay reading a start bit.
+ * Jobs still running when a byte starts are counted in _deferredOverruns.
+ *
+ * WCET ~0.06ms: averaging the light readings and setting the intensity. EEPROM writes are
+ * only started here, and are skipped while a previous write is still in progress. With
+ * ENABLE_TELEMETRY, the run that sends the second's record takes ~0.25ms more.
+ */
+static inline void task_deferred(const uint8_t reading)
+{
+    REG_WRITE(GIFR, _BV(INTF0));
+
+#ifdef ENABLE_TELEMETRY
+    if (_telemetry.recordPending) {
+        telemetry_send_record();
+    }
+#endif
+
+    // Follow the ambient light level, unless the button is pulling the reading down
+    if (reading >= kButtonThreshold) {
+        display_adjust_brightness(reading);
+    }
+
+#ifdef ENABLE_HOLDOVER
+    // Write out the learned rate a byte at a time
+    holdover_save_step();
+#endif
+
+    // Save the timezone once the button is released, if it was changed
+    if (_buttonHeldTicks == 0 && (REG_READ(EECR) & _BV(EEPE)) == 0) {
+        if (unchecked_eeprom_read(EEPROM_TIMEZONE_ADDR) != (uint8_t) _timezoneOffset) {
+            unchecked_eeprom_write(EEPROM_TIMEZONE_ADDR, _timezoneOffset);
         }
+    }
+
+    if (REG_READ(GIFR) & _BV(INTF0)) {
+        ++_deferredOverruns;
+    }
+}
+
+/**
+ * Button: debounce the button and step the timezone while it's held
+ *
+ * This runs on every timer overflow, so it never blocks. The timezone steps after the button
+ * has been held for kButtonStepTicks overflows (~430ms) then every ~430ms after that. It is saved by
+ * task_deferred() once the button is released.
+ *
+ * WCET ~0.2ms to step and send the timezone to the display.
+ */
+static void task_button(const uint8_t reading)
+{
+    if (reading < kButtonThreshold) {
+        ++_buttonHeldTicks;
+
+        // Require the reading to stay below the threshold for a series of readings
+        // (During real world use the ADC reading was occasionally dipping below the
+        // threshold without a button press, causing the timezone to increment unexpectedly.
+        if (_buttonHeldTicks < kButtonStepTicks) {
+            return;
+        }
+
+        // Stay non-zero so the release is still seen
+        _buttonHeldTicks = 1;
+
+#ifdef ENABLE_PPS_STATS
+        // Step through the diagnostics instead of changing timezone
+        if (_diagPage != 0) {
+            display_next_stats_page();
+            display_buffer_send();
+            return;
+        }
+#endif
 
-        // Push buffer to the display
+        // Update timezone
+        // The time replaces this on the display again with the next timepulse
+        increment_timezone();
+        display_timezone();
         display_buffer_send();
+
+        // Put the time back in the buffer so the timezone only shows until the next timepulse
+        display_buffer_update(&_gpsTime);
+        return;
     }
+
+    _buttonHeldTicks = 0;
 }
 
+#ifdef ENABLE_SLEEP
+/**
+ * Sleep until a start bit, a change on LOAD or a timer overflow
+ *
+ * Idle sleep stops the CPU but leaves Timer0, the ADC and pin change detection running, and
+ * wakes up without any oscillator start-up time. Power-down can't be used: the fuses in the
+ * Makefile give a 64ms start-up time, and Timer0 would stop.
+ */
+static inline void scheduler_sleep()
+{
+#ifdef ENABLE_TELEMETRY
+    const uint8_t sleepStart = REG_READ(TCNT0);
+#endif
+
+    // Wake on a start bit as well as the timepulse
+    REG_WRITE(PCMSK, _BV(PIN_LOAD) | _BV(PIN_SOFT_RX));
+
+    // Only sleep if the start bit didn't arrive before it could wake the CPU
+    // The instruction after sei() runs before any pending interrupt, so none can be missed
+    cli();
+
+    if (REG_READ(PINB) & _BV(PIN_SOFT_RX)) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+
+    sei();
+
+#ifdef ENABLE_TELEMETRY
+    // Sleep ends on every overflow, so it always lasts less than 256 ticks
+    const uint8_t sleptTicks = REG_READ(TCNT0) - sleepStart;
+#endif
+
+    REG_WRITE(PCMSK, _BV(PIN_LOAD));
+
+    // Read a byte straight away if it woke the CPU, as the wake-up took time out of the start bit
+    if ((REG_READ(PINB) & _BV(PIN_SOFT_RX)) == 0) {
+        hal_task_start(UartByte);
+        task_uart_byte(uart_read_byte_after_wake());
+        hal_task_end(UartByte);
+    }
+
+#ifdef ENABLE_TELEMETRY
+    _telemetry.sleepTicks += sleptTicks;
+
+    // Time asleep isn't time spent waiting behind a task
+    _telemetry.loopStart += sleptTicks;
+#endif
+}
+#endif
+
+/**
+ * Run the highest priority task that has something to do
+ */
+static inline void scheduler_poll()
+{
+#ifdef ENABLE_TELEMETRY
+    // The longest pass is the longest any event waited behind another task
+    telemetry_loop_start();
+#endif
+
+    hal_task_start(Timepulse);
+
+    if (task_timepulse()) {
+        hal_task_end(Timepulse);
+        return;
+    }
+
+    // Start bit from the GPS
+    if ((REG_READ(PINB) & _BV(PIN_SOFT_RX)) == 0) {
+        hal_task_start(UartByte);
+        task_uart_byte(uart_read_byte());
+        hal_task_end(UartByte);
+        return;
+    }
+
+    // The remaining tasks wait for the parser to be between sentences: running into the
+    // start of a byte would make the UART misread it
+    if (!gps_parser_is_idle(&_gpsParser) || !timer_has_overflowed()) {
+#ifdef ENABLE_SLEEP
+        // Nothing else to do until the next event
+        scheduler_sleep();
+#else
+        hal_idle();
+#endif
+        return;
+    }
+
+    timer_reset_overflow();
+
+    if (_quietTicks != 0xFF) {
+        ++_quietTicks;
+    }
+
+#ifdef ENABLE_ADC_SLEEP
+    // The GPS doesn't send in the quiet gap, so only sleep through the conversion there
+    const bool quiet = is_quiet_gap();
+
+    // The button pulls the LDR reading to zero
+    uint8_t reading = adc_read(quiet);
+
+    // The first conversion after the ADC powers up can be disturbed while the input settles,
+    // so confirm a low reading before it's taken as the button
+    if (reading < kButtonThreshold) {
+        reading = adc_read(quiet);
+    }
+
+    // Receive a byte that started during the reading before anything else
+    if ((REG_READ(PINB) & _BV(PIN_SOFT_RX)) == 0) {
+        return;
+    }
+#else
+    // The button pulls the LDR reading to zero
+    const uint8_t reading = adc_read(false);
+#endif
+
+    if (is_quiet_gap()) {
+        hal_task_start(Deferred);
+        task_deferred(reading);
+        hal_task_end(Deferred);
+    }
+
+    hal_task_start(Button);
+    task_button(reading);
+    hal_task_end(Button);
+
+    // Anything clocked out above replaced a preloaded seconds digit
+    display_prepare_latch();
+}
+
+int main(void)
+{
+    // Flag changes on LOAD, which the timepulse pulls low
+    REG_WRITE(PCMSK, _BV(PIN_LOAD));
+
+#ifdef ENABLE_PPS_INTERRUPT
+    // ...and interrupt on them
+    REG_WRITE(GIMSK, _BV(PCIE));
+#endif
+
+    setup_pins();
+    setup_adc();
+    setup_timer();
+
+#ifdef USE_INTERRUPTS
+    sei();
+#endif
+
+    max7219_init();
+
+#if kNumChips > 1
+    // Chips that aren't used for time or date would otherwise show zeros
+    display_clear();
+#endif
+
+    restore_timezone();
+
+#ifdef ENABLE_HOLDOVER
+    holdover_restore();
+#endif
+
+#ifdef ENABLE_PPS_STATS
+#ifndef ENABLE_ADC_SLEEP
+    // Give the free-running ADC a couple of timer periods to take its first readings
+    for (uint8_t i = 2; i != 0; --i) {
+        while (!timer_has_overflowed()) {
+            hal_idle();
+        }
+
+        timer_reset_overflow();
+    }
+#endif
+
+    // Holding the button at power-up enters the timing diagnostics
+    if (adc_read(true) < kButtonThreshold) {
+        _diagPage = 1;
+        display_stats_page();
+        display_buffer_send();
+
+        while (adc_read(true) < kButtonThreshold);
+    }
+#endif
+
+    // Fixed priority scheduler: run the most important task that has something to do
+    while (hal_running()) {
+        scheduler_poll();
+    }
+
+    // Only reached on the host, once the run is stopped
+    return 0;
+}
@@ -3,6 +3,14 @@
 
 #include <stdbool.h>
 
+// NMEA sentences are limited to 79 characters including the start '$' and end '\r\n'
+#define NMEA_MAX_SENTENCE_LENGTH 79
+
+// Optionally called when the '$' starting a sentence has been read
+#ifndef NMEA_SENTENCE_START_HOOK
+#define NMEA_SENTENCE_START_HOOK()
+#endif
+
 enum GPRMCField {
     GPRMC_SentenceType = 0,
     GPRMC_Timestamp, // UTC of position fix
@@ -83,171 +91,207 @@ static inline uint8_t gps_atoi(char *str)
     return result;
 }
 
-AVRSTATIC GpsReadStatus gps_read_time(GpsTime* output)
+AVRSTATIC bool gps_parser_is_idle(const GpsParser* parser)
 {
+    return parser->state == kSearchStart;
+}
 
-    uint8_t calculatedChecksum = 0x0;
-
-    // Buffer for storing number pairs read from the GPS
-    char buffer[2];
-    uint8_t bufIndex = 0;
-
-    // Which field in the output is currently being written to
-    uint8_t outputIndex = 0;
-
+/**
+ * Process one byte of a sentence, returning kGPS_InProgress if more are needed
+ */
+static inline GpsReadStatus gps_parse_byte_inner(GpsParser* parser, GpsTime* output, char byte)
+{
     // RMC sentence header (without null termination)
     static const __flash char GPRMC[5] = "GPRMC";
-    uint8_t typeStrIndex = 0;
-
-    // Initial states for  sentence matching
-    enum NmeaReadState state = kSearchStart;
-    enum GPRMCField field = GPRMC_SentenceType;
-
-    // Flag to indicate the decimal portion of time is being skipped
-    bool hitTimeDecimal = false;
 
-    // Flag to indicate the date/time field was non-empty
-    // During start-up the GPS can return blank fields while it aquires a signal
-    bool sawTimeFields = false;
-
-    // NMEA sentences are limited to 79 characters including the start '$' and end '\r\n'
-    // Limit iterations to this for sanity
-    for (uint8_t i = 79; i != 0; --i) {
-        char byte = uart_read_byte();
+    switch (parser->state) {
+        case kSearchStart: {
+            // Bail out if end of line hit
+            if (byte == '\n') {
+                return kGPS_NoMatch;
+            }
 
-        switch (state) {
-            case kSearchStart: {
-                // Bail out if end of line hit
-                if (byte == '\n') {
-                    return kGPS_NoMatch;
-                }
+            // Look for start character
+            if (byte == '$') {
+                NMEA_SENTENCE_START_HOOK();
+                parser->state = kReadType;
+            }
 
-                // Look for start character
-                if (byte == '$') {
-                    state = kReadType;
-                    continue;
-                }
+            return kGPS_InProgress;
+        }
 
-                // Not the character we're looking for
-                continue;
+        case kSkipSentence: {
+            // Ignore all further bytes until the sentence ends
+            if (byte != '\n') {
+                return kGPS_InProgress;
             }
 
-            case kSkipSentence: {
-                // Ignore all further bytes until the sentence ends
-                if (byte != '\n') {
-                    continue;
-                }
+            return kGPS_NoMatch;
+        }
 
-                return kGPS_NoMatch;
-            }
+        case kReadType: {
+            // Include sentence type in checksum
+            parser->calculatedChecksum ^= byte;
 
-            case kReadType: {
-                // Include sentence type in checksum
-                calculatedChecksum ^= byte;
-
-                // Try to match against sentence type we want
-                if (byte == GPRMC[typeStrIndex]) {
-                    if (typeStrIndex == (sizeof(GPRMC) - 1)) {
-                        // Matched last character in the flag we want
-                        state = kReadFields;
-                    } else {
-                        ++typeStrIndex;
-                    }
+            // Try to match against sentence type we want
+#ifdef ENABLE_ANY_TALKER
+            // Any talker ID is accepted in place of "GP", eg. "GN" from multi-constellation receivers
+            if (parser->index < 2 || byte == GPRMC[parser->index]) {
+#else
+            if (byte == GPRMC[parser->index]) {
+#endif
+                if (parser->index == (sizeof(GPRMC) - 1)) {
+                    // Matched last character in the flag we want
+                    parser->state = kReadFields;
+                    parser->index = 0;
+
+#ifdef ENABLE_GPS_DATE
+                    // A sentence with an empty date field leaves it as zeros, not the last date
+                    output->day = 0;
+                    output->month = 0;
+                    output->year = 0;
+#endif
                 } else {
-                    // Saw a '$' but the sentence type didn't match
-                    // Ignore everything further in this message
-                    state = kSkipSentence;
+                    ++parser->index;
                 }
-
-                continue;
+            } else {
+                // Saw a '$' but the sentence type didn't match
+                // Ignore everything further in this message
+                parser->state = kSkipSentence;
             }
 
-            case kReadFields: {
+            return kGPS_InProgress;
+        }
 
-                // Asterisk marks the end of the data and start of the checksum
-                if (byte == '*') {
-                    state = kChecksumVerify;
-                    continue;
-                }
+        case kReadFields: {
 
-                // Calculate checksum across sentence contents
-                calculatedChecksum ^= byte;
+            // Asterisk marks the end of the data and start of the checksum
+            if (byte == '*') {
+                parser->state = kChecksumVerify;
+                return kGPS_InProgress;
+            }
 
-                // Fields are delimited by commas
-                if (byte == ',') {
-                    ++field;
-                    continue;
-                }
+            // Calculate checksum across sentence contents
+            parser->calculatedChecksum ^= byte;
 
-                switch (field) {
-                    case GPRMC_Timestamp: {
+            // Fields are delimited by commas
+            if (byte == ',') {
+                ++parser->field;
+                return kGPS_InProgress;
+            }
 
-                        // Skip the fractional part of the timestamp field as we don't use it
-                        // This isn't guaranteed to be present in every message
-                        if (hitTimeDecimal || byte == '.') {
-                            hitTimeDecimal = true;
-                            continue;
-                        }
+            switch (parser->field) {
+                case GPRMC_Timestamp: {
 
-#ifdef ENABLE_GPS_DATE
-                        // INTENTIONAL FALL THROUGH TO DATESTAMP
+                    // Skip the fractional part of the timestamp field as we don't use it
+                    // This isn't guaranteed to be present in every message
+                    if (parser->hitTimeDecimal || byte == '.') {
+                        parser->hitTimeDecimal = true;
+                        return kGPS_InProgress;
                     }
 
-                    case GPRMC_DateStamp: {
+#ifdef ENABLE_GPS_DATE
+                    // INTENTIONAL FALL THROUGH TO DATESTAMP
+                }
+
+                case GPRMC_DateStamp: {
 #endif
 
-                        // Collect pairs of characters and convert them to numbers
-                        buffer[bufIndex] = byte;
-                        bufIndex++;
+                    // Collect pairs of characters and convert them to numbers
+                    parser->buffer[parser->bufIndex] = byte;
+                    parser->bufIndex++;
 
-                        if (bufIndex == 2) {
-                            bufIndex = 0;
-                            ((uint8_t*) output)[outputIndex] = gps_atoi(buffer);
-                            ++outputIndex;
-                        } else {
-                            continue;
+                    if (parser->bufIndex == 2) {
+                        // More digits than the output has room for: the field is malformed
+                        if (parser->index == sizeof(GpsTime)) {
+                            return kGPS_BadFormat;
                         }
 
-                        sawTimeFields = true;
-                        continue;
+                        parser->bufIndex = 0;
+                        ((uint8_t*) output)[parser->index] = gps_atoi(parser->buffer);
+                        ++parser->index;
+                        parser->sawTimeFields = true;
                     }
 
-                    default:
-                        // Skip other fields
-                        continue;
+                    return kGPS_InProgress;
                 }
+
+                default:
+                    // Skip other fields
+                    return kGPS_InProgress;
             }
+        }
 
-            case kChecksumVerify: {
+        case kChecksumVerify: {
 
-                // Collect checksum
-                buffer[bufIndex] = byte;
-                bufIndex++;
+            // Collect checksum
+            parser->buffer[parser->bufIndex] = byte;
+            parser->bufIndex++;
 
-                if (bufIndex < 2) {
-                    continue;
-                }
+            if (parser->bufIndex < 2) {
+                return kGPS_InProgress;
+            }
 
-                const uint8_t receivedChecksum = hex2int(buffer);
+            const uint8_t receivedChecksum = hex2int(parser->buffer);
 
-                if (receivedChecksum == calculatedChecksum) {
-                    if (sawTimeFields) {
-                        return kGPS_Success;
-                    } else {
-                        return kGPS_NoSignal;
-                    }
+            if (receivedChecksum == parser->calculatedChecksum) {
+                if (parser->sawTimeFields) {
+                    return kGPS_Success;
                 } else {
-                    return kGPS_InvalidChecksum;
+                    return kGPS_NoSignal;
                 }
+            } else {
+                return kGPS_InvalidChecksum;
             }
-
-            default:
-                // Entered an unrecognised state: abort
-                return kGPS_BadFormat;
         }
+
+        default:
+            // Entered an unrecognised state: abort
+            return kGPS_BadFormat;
+    }
+}
+
+AVRSTATIC GpsReadStatus gps_parse_byte(GpsParser* parser, GpsTime* output, char byte)
+{
+    // A '$' only ever starts a sentence: drop one that was cut short by a misread byte, or the
+    // next sentence is skipped as part of it and the two run on past the length limit
+    if (byte == '$') {
+        *parser = (GpsParser) {0};
     }
 
-    // Something has gone wrong
-    // The loop ended, which means the sentence was longer than allowed by NMEA
-    return kGPS_BadFormat;
-}
\ No newline at end of file
+    GpsReadStatus status = gps_parse_byte_inner(parser, output, byte);
+
+    // Something has gone wrong if a sentence runs on longer than NMEA allows
+    if (status == kGPS_InProgress && ++parser->length == NMEA_MAX_SENTENCE_LENGTH) {
+        status = kGPS_BadFormat;
+    }
+
+    if (status != kGPS_InProgress) {
+        // Start searching for the next sentence
+        *parser = (GpsParser) {0};
+    }
+
+    return status;
+}
+
+/**
+ * Read bytes from uart_read_byte() until a sentence is complete
+ *
+ * The firmware feeds gps_parse_byte() from its scheduler instead, but this is kept for
+ * reading a single sentence from a stream (as the tests do).
+ */
+__attribute__((unused))
+AVRSTATIC GpsReadStatus gps_read_time(GpsTime* output)
+{
+    GpsParser parser = {0};
+    GpsReadStatus status;
+
+    // A '$' restarts the parser and its length count, so bound the bytes read here as well
+    uint8_t remaining = NMEA_MAX_SENTENCE_LENGTH;
+
+    do {
+        status = gps_parse_byte(&parser, output, uart_read_byte());
+    } while (status == kGPS_InProgress && --remaining != 0);
+
+    return status == kGPS_InProgress ? kGPS_BadFormat : status;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef struct GpsTime {
@@ -28,8 +29,50 @@ typedef enum GpsReadStatus {
 
     // The sentence had too many characters or fields and could not be parsed
     kGPS_BadFormat,
+
+    // More bytes are needed before a sentence is complete (from gps_parse_byte only)
+    kGPS_InProgress,
 } GpsReadStatus;
 
+/**
+ * State for matching a GPRMC sentence one byte at a time
+ *
+ * A zeroed struct is ready to start searching for a sentence.
+ */
+typedef struct GpsParser {
+    uint8_t state;
+    uint8_t field;
+    uint8_t length;
+    uint8_t calculatedChecksum;
+
+    // Position in the sentence type while matching it, then in the output struct
+    uint8_t index;
+
+    // Buffer for storing number pairs read from the GPS
+    char buffer[2];
+    uint8_t bufIndex;
+
+    // Flag to indicate the decimal portion of time is being skipped
+    bool hitTimeDecimal;
+
+    // Flag to indicate the date/time field was non-empty
+    // During start-up the GPS can return blank fields while it aquires a signal
+    bool sawTimeFields;
+} GpsParser;
+
+/**
+ * Feed one byte from the GPS to a sentence parser
+ *
+ * Returns kGPS_InProgress until a sentence is complete, then the same result gps_read_time()
+ * would have. The parser resets itself to search for the next sentence after any other result.
+ */
+AVRSTATIC GpsReadStatus gps_parse_byte(GpsParser* parser, GpsTime* output, char byte);
+
+/**
+ * Check if the parser is between sentences
+ */
+AVRSTATIC bool gps_parser_is_idle(const GpsParser* parser);
+
 /**
  * Attempt to match GPRMC sentence in the output of uart_read_byte()
  *
@@ -0,0 +1,522 @@
+/**
+ * Run the built firmware (main.elf) cycle by cycle in simavr against a simulated GPS
+ *
+ * The GPS sends bit-timed NMEA sentences on PB1 after pulling LOAD (PB3) low for each
+ * timepulse, and the levels on PB0, PB2 and PB3 are decoded as a chain of MAX7219s. Each
+ * second the displayed time is checked against the timepulse, and the cycles from the
+ * timepulse to the seconds digit being latched are measured, as is the deepest the stack goes.
+ * The exit status is non-zero if any second was wrong or a latency went over the limit given
+ * with -L.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+#include "avr_adc.h"
+#include "avr_eeprom.h"
+
+#include "max7219.h"
+
+// Port B registers in the ATtiny13A's data space (I/O address + 0x20)
+#define PINB_ADDR 0x36
+#define DDRB_ADDR 0x37
+#define PORTB_ADDR 0x38
+
+// Stack pointer in the data space (the ATtiny13A's 64 bytes of RAM need no high byte)
+#define SPL_ADDR 0x5D
+
+#define PIN_MOSI 0
+#define PIN_SOFT_RX 1
+#define PIN_SCK 2
+#define PIN_LOAD 3
+
+// Digit register of the seconds ones on the first MAX7219
+#define kSecondsOnesDigit 6
+
+// Timepulses before the display is expected to be showing the right time
+#define kWarmupSeconds 2
+
+// Seconds simulated without -s, the same as SIM_SECONDS for `make sim`
+#define kDefaultSeconds 120
+
+typedef struct Options {
+    const char* elfPath;
+    const char* mcu;
+    uint32_t frequency;
+    uint32_t baud;
+    uint32_t seconds;
+    uint32_t startTime; // Seconds since midnight of the first timepulse
+    uint8_t numChips;
+    double pulseMs;
+    double sentenceDelayMs;
+    int8_t timezone;
+    uint32_t lightMillivolts;
+    double maxLatencyUs; // Zero for no limit
+} Options;
+
+/**
+ * Typical ATtiny13A supply current at 5V, read off the datasheet's active and idle curves
+ */
+typedef struct SupplyCurrent {
+    uint32_t frequency;
+    double activeMa;
+    double idleMa;
+} SupplyCurrent;
+
+static const SupplyCurrent supplyCurrents[] = {
+    {9600000, 6.0, 2.0},
+    {4800000, 3.2, 1.0},
+    {1200000, 1.0, 0.3},
+};
+
+typedef struct Sim {
+    Options options;
+    avr_t* avr;
+    avr_irq_t* rxIrq;
+    avr_irq_t* loadIrq;
+
+    // Timepulse
+    uint32_t time; // Seconds since midnight the current timepulse marks
+    uint32_t pulses;
+    avr_cycle_count_t nextPulse;
+    avr_cycle_count_t pulseStart;
+    avr_cycle_count_t pulseCycles;
+    bool pulseActive;
+
+    // UART transmitter: bit n of the sentences starts n bit times after txStart
+    char txBuffer[256];
+    size_t txLength;
+    size_t txBit;
+    avr_cycle_count_t txStart;
+    double cyclesPerBit;
+
+    Max7219Model display;
+
+    // Measurements
+    bool awaitingLatch;
+    uint32_t secondsChecked;
+    uint32_t secondsWrong;
+    uint32_t missedLatches;
+    uint32_t numLatencies;
+    avr_cycle_count_t minLatency;
+    avr_cycle_count_t maxLatency;
+    double totalLatency;
+    avr_cycle_count_t sleepCycles;
+    uint16_t lowestStack;
+} Sim;
+
+static uint8_t nmea_checksum(const char* sentence)
+{
+    uint8_t checksum = 0;
+
+    // Everything between the '$' and the '*'
+    for (const char* c = sentence + 1; *c != '\0' && *c != '*'; ++c) {
+        checksum ^= *c;
+    }
+
+    return checksum;
+}
+
+/**
+ * Append a sentence followed by its checksum and line ending
+ */
+static size_t append_sentence(char* buffer, size_t size, const char* sentence)
+{
+    return snprintf(buffer, size, "%s*%02X\r\n", sentence, nmea_checksum(sentence));
+}
+
+/**
+ * Queue the sentences a GPS sends after a timepulse, describing the time it marked
+ */
+static void queue_sentences(Sim* sim, avr_cycle_count_t start)
+{
+    const uint32_t hour = (sim->time / 3600) % 24;
+    const uint32_t minute = (sim->time / 60) % 60;
+    const uint32_t second = sim->time % 60;
+
+    char rmc[100];
+    char gga[100];
+
+    snprintf(rmc, sizeof(rmc), "$GPRMC,%02u%02u%02u.00,A,5133.82,N,00042.24,W,000.0,000.0,040219,,,A",
+        hour, minute, second);
+    snprintf(gga, sizeof(gga), "$GPGGA,%02u%02u%02u.00,5133.82,N,00042.24,W,1,08,1.0,10.0,M,0.0,M,,",
+        hour, minute, second);
+
+    size_t length = append_sentence(sim->txBuffer, sizeof(sim->txBuffer), rmc);
+    length += append_sentence(sim->txBuffer + length, sizeof(sim->txBuffer) - length, gga);
+
+    sim->txLength = length;
+    sim->txBit = 0;
+    sim->txStart = start;
+}
+
+/**
+ * Level of bit n of the queued sentences: a start bit, 8 data bits (LSB first) and a stop bit per byte
+ */
+static bool tx_level(const Sim* sim, size_t n)
+{
+    const uint8_t byte = sim->txBuffer[n / 10];
+    const uint8_t bit = n % 10;
+
+    if (bit == 0) {
+        return false;
+    }
+
+    if (bit == 9) {
+        return true;
+    }
+
+    return (byte >> (bit - 1)) & 1;
+}
+
+static avr_cycle_count_t tx_bit_cycle(const Sim* sim, size_t n)
+{
+    return sim->txStart + (avr_cycle_count_t) llround(n * sim->cyclesPerBit);
+}
+
+static void set_load_input(Sim* sim)
+{
+    // The timepulse pulls LOAD low through a resistor, so the firmware wins when it drives the pin
+    avr_raise_irq(sim->loadIrq, !sim->pulseActive);
+}
+
+static void display_time(const Sim* sim, uint8_t* digits)
+{
+    for (uint8_t i = 0; i < 6; ++i) {
+        digits[i] = max7219_model_digit(&sim->display, 0, i + 1);
+    }
+}
+
+/**
+ * Check the display shows the time of the last timepulse, just before the next one
+ */
+static void check_second(Sim* sim)
+{
+    if (sim->pulses <= kWarmupSeconds) {
+        return;
+    }
+
+    const uint32_t local = (sim->time + 86400 + sim->options.timezone * 3600) % 86400;
+    const uint8_t expected[6] = {
+        (local / 3600) / 10, (local / 3600) % 10,
+        ((local / 60) % 60) / 10, ((local / 60) % 60) % 10,
+        (local % 60) / 10, (local % 60) % 10,
+    };
+
+    uint8_t shown[6];
+    display_time(sim, shown);
+
+    ++sim->secondsChecked;
+
+    if (sim->awaitingLatch) {
+        ++sim->missedLatches;
+    }
+
+    if (memcmp(shown, expected, sizeof(shown)) != 0) {
+        ++sim->secondsWrong;
+        fprintf(stderr, "Second %u: showing %u%u:%u%u:%u%u, expected %u%u:%u%u:%u%u\n",
+            sim->pulses,
+            shown[0], shown[1], shown[2], shown[3], shown[4], shown[5],
+            expected[0], expected[1], expected[2], expected[3], expected[4], expected[5]);
+    }
+}
+
+/**
+ * Drive the timepulse and UART lines, rescheduling itself for the next edge
+ */
+static avr_cycle_count_t stimulus_event(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+    Sim* sim = param;
+    const avr_cycle_count_t cyclesPerSecond = sim->options.frequency;
+
+    for (;;) {
+        const avr_cycle_count_t nextPulse = sim->nextPulse;
+        const avr_cycle_count_t pulseEnd = sim->pulseStart + sim->pulseCycles;
+        const bool txPending = sim->txBit < sim->txLength * 10;
+
+        if (when >= nextPulse) {
+            if (sim->pulses != 0) {
+                check_second(sim);
+                ++sim->time;
+            }
+
+            ++sim->pulses;
+            sim->pulseStart = nextPulse;
+            sim->nextPulse = nextPulse + cyclesPerSecond;
+            sim->pulseActive = true;
+            sim->awaitingLatch = sim->pulses > kWarmupSeconds;
+            set_load_input(sim);
+
+            const avr_cycle_count_t delay = sim->options.sentenceDelayMs * cyclesPerSecond / 1000;
+            queue_sentences(sim, nextPulse + delay);
+            continue;
+        }
+
+        if (sim->pulseActive && when >= pulseEnd) {
+            sim->pulseActive = false;
+            set_load_input(sim);
+            continue;
+        }
+
+        if (txPending && when >= tx_bit_cycle(sim, sim->txBit)) {
+            avr_raise_irq(sim->rxIrq, tx_level(sim, sim->txBit));
+            ++sim->txBit;
+            continue;
+        }
+
+        // Nothing else due yet: wake up for whichever edge is next
+        avr_cycle_count_t next = nextPulse;
+
+        if (sim->pulseActive && pulseEnd < next) {
+            next = pulseEnd;
+        }
+
+        if (txPending && tx_bit_cycle(sim, sim->txBit) < next) {
+            next = tx_bit_cycle(sim, sim->txBit);
+        }
+
+        return next;
+    }
+}
+
+/**
+ * Feed the MAX7219 model from the pins after each instruction and time the seconds digit latching
+ */
+static void sample_outputs(Sim* sim)
+{
+    const uint8_t port = sim->avr->data[PORTB_ADDR];
+    const uint8_t ddr = sim->avr->data[DDRB_ADDR];
+    const bool driven = ddr & (1 << PIN_LOAD);
+
+    const bool load = driven ? (port & (1 << PIN_LOAD)) != 0 : !sim->pulseActive;
+
+    // Once the firmware releases LOAD, the pin reads the timepulse again
+    if (!driven && ((sim->avr->data[PINB_ADDR] >> PIN_LOAD) & 1) != load) {
+        set_load_input(sim);
+    }
+
+    const bool latched = max7219_model_update(&sim->display,
+        (port & (1 << PIN_MOSI)) != 0,
+        (port & (1 << PIN_SCK)) != 0,
+        load
+    );
+
+    if (!latched || !sim->awaitingLatch) {
+        return;
+    }
+
+    const uint8_t expectedOnes = ((sim->time + 86400 + sim->options.timezone * 3600) % 86400) % 10;
+
+    if (max7219_model_digit(&sim->display, 0, kSecondsOnesDigit) == expectedOnes) {
+        const avr_cycle_count_t latency = sim->avr->cycle - sim->pulseStart;
+
+        if (sim->numLatencies == 0 || latency < sim->minLatency) {
+            sim->minLatency = latency;
+        }
+
+        if (latency > sim->maxLatency) {
+            sim->maxLatency = latency;
+        }
+
+        sim->totalLatency += latency;
+        ++sim->numLatencies;
+        sim->awaitingLatch = false;
+    }
+}
+
+static double cycles_to_us(const Sim* sim, double cycles)
+{
+    return cycles * 1000000.0 / sim->options.frequency;
+}
+
+static void print_report(const Sim* sim, avr_cycle_count_t totalCycles)
+{
+    const Options* o = &sim->options;
+
+    printf("Simulated %us at %uHz, %u baud\n", o->seconds, o->frequency, o->baud);
+    printf("  Seconds checked: %u, wrong: %u, missed latches: %u\n",
+        sim->secondsChecked, sim->secondsWrong, sim->missedLatches);
+
+    if (sim->numLatencies != 0) {
+        const double mean = sim->totalLatency / sim->numLatencies;
+
+        printf("  Timepulse to LOAD: min %llu, mean %.0f, max %llu cycles (max %.1fus)\n",
+            (unsigned long long) sim->minLatency, mean, (unsigned long long) sim->maxLatency,
+            cycles_to_us(sim, sim->maxLatency));
+    }
+
+    printf("  Stack: %u bytes at its deepest\n", sim->avr->ramend - sim->lowestStack);
+
+    const double asleep = totalCycles == 0 ? 0 : (double) sim->sleepCycles / totalCycles;
+    printf("  CPU asleep %.1f%% of the time", asleep * 100.0);
+
+    for (size_t i = 0; i < sizeof(supplyCurrents) / sizeof(supplyCurrents[0]); ++i) {
+        const SupplyCurrent* c = &supplyCurrents[i];
+
+        if (c->frequency == o->frequency) {
+            printf(", ~%.1fmA (datasheet typical at 5V)",
+                c->activeMa * (1.0 - asleep) + c->idleMa * asleep);
+        }
+    }
+
+    printf("\n");
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options] main.elf\n"
+        "  -f hz      CPU frequency the firmware was built for (default 9600000)\n"
+        "  -b baud    GPS baud rate (default 9600)\n"
+        "  -s secs    Seconds to simulate (default %u)\n"
+        "  -t hhmmss  UTC time of the first timepulse (default 235950)\n"
+        "  -n chips   MAX7219s in the chain (default 1)\n"
+        "  -w ms      Timepulse width (default 100)\n"
+        "  -d ms      Delay from the timepulse to the first sentence (default 30)\n"
+        "  -z hours   Timezone to store in EEPROM (default 0)\n"
+        "  -l mV      Voltage on the LDR input (default 2000)\n"
+        "  -L us      Fail if the timepulse to LOAD latency ever exceeds this\n"
+        "  -m mcu     simavr core to run (default attiny13)\n",
+        name, kDefaultSeconds
+    );
+}
+
+int main(int argc, char** argv)
+{
+    Sim sim = {
+        .options = {
+            .mcu = "attiny13",
+            .frequency = 9600000,
+            .baud = 9600,
+            .seconds = kDefaultSeconds,
+            .startTime = 23 * 3600 + 59 * 60 + 50,
+            .numChips = 1,
+            .pulseMs = 100,
+            .sentenceDelayMs = 30,
+            .lightMillivolts = 2000,
+        },
+    };
+
+    Options* o = &sim.options;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:b:s:t:n:w:d:z:l:L:m:h")) != -1) {
+        switch (opt) {
+            case 'f': o->frequency = strtoul(optarg, NULL, 10); break;
+            case 'b': o->baud = strtoul(optarg, NULL, 10); break;
+            case 's': o->seconds = strtoul(optarg, NULL, 10); break;
+            case 'n': o->numChips = atoi(optarg); break;
+            case 'w': o->pulseMs = atof(optarg); break;
+            case 'd': o->sentenceDelayMs = atof(optarg); break;
+            case 'z': o->timezone = atoi(optarg); break;
+            case 'l': o->lightMillivolts = strtoul(optarg, NULL, 10); break;
+            case 'L': o->maxLatencyUs = atof(optarg); break;
+            case 'm': o->mcu = optarg; break;
+
+            case 't': {
+                const unsigned long t = strtoul(optarg, NULL, 10);
+                o->startTime = (t / 10000) * 3600 + ((t / 100) % 100) * 60 + (t % 100);
+                break;
+            }
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || o->numChips == 0 || o->numChips > MAX7219_MODEL_MAX_CHIPS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    o->elfPath = argv[optind];
+
+    elf_firmware_t firmware = {0};
+    if (elf_read_firmware(o->elfPath, &firmware) != 0) {
+        fprintf(stderr, "Failed to load %s\n", o->elfPath);
+        return 1;
+    }
+
+    sim.avr = avr_make_mcu_by_name(o->mcu);
+    if (sim.avr == NULL) {
+        fprintf(stderr, "simavr doesn't know the %s core\n", o->mcu);
+        return 1;
+    }
+
+    avr_init(sim.avr);
+    firmware.frequency = o->frequency;
+    avr_load_firmware(sim.avr, &firmware);
+
+    sim.avr->vcc = 5000;
+    sim.avr->avcc = 5000;
+
+    // The timezone is restored from EEPROM, where an erased byte would read as -1
+    uint8_t eeprom[1] = {(uint8_t) o->timezone};
+    avr_eeprom_desc_t eepromDesc = {.ee = eeprom, .offset = 0, .size = sizeof(eeprom)};
+    avr_ioctl(sim.avr, AVR_IOCTL_EEPROM_SET, &eepromDesc);
+
+    // The LDR divider, which stays above the button threshold
+    avr_raise_irq(avr_io_getirq(sim.avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC2), o->lightMillivolts);
+
+    sim.rxIrq = avr_io_getirq(sim.avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PIN_SOFT_RX);
+    sim.loadIrq = avr_io_getirq(sim.avr, AVR_IOCTL_IOPORT_GETIRQ('B'), PIN_LOAD);
+
+    max7219_model_init(&sim.display, o->numChips);
+
+    // Both lines idle high. The first timepulse arrives half a second after power-up.
+    sim.cyclesPerBit = (double) o->frequency / o->baud;
+    sim.pulseCycles = (avr_cycle_count_t) (o->pulseMs * o->frequency / 1000);
+    sim.nextPulse = o->frequency / 2;
+    sim.lowestStack = sim.avr->ramend;
+    sim.time = o->startTime;
+    avr_raise_irq(sim.rxIrq, 1);
+    set_load_input(&sim);
+
+    avr_cycle_timer_register(sim.avr, o->frequency / 2, stimulus_event, &sim);
+
+    const avr_cycle_count_t endCycle = (avr_cycle_count_t) o->frequency * (o->seconds + 1);
+
+    while (sim.avr->cycle < endCycle) {
+        const avr_cycle_count_t before = sim.avr->cycle;
+        const bool sleeping = sim.avr->state == cpu_Sleeping;
+
+        const int state = avr_run(sim.avr);
+
+        if (state == cpu_Done || state == cpu_Crashed) {
+            fprintf(stderr, "Firmware stopped at cycle %llu (state %d)\n",
+                (unsigned long long) sim.avr->cycle, state);
+            return 1;
+        }
+
+        if (sleeping) {
+            sim.sleepCycles += sim.avr->cycle - before;
+        }
+
+        if (sim.avr->data[SPL_ADDR] < sim.lowestStack) {
+            sim.lowestStack = sim.avr->data[SPL_ADDR];
+        }
+
+        sample_outputs(&sim);
+    }
+
+    print_report(&sim, sim.avr->cycle);
+
+    bool failed = sim.secondsChecked == 0 || sim.secondsWrong != 0 || sim.missedLatches != 0;
+
+    if (o->maxLatencyUs != 0 && cycles_to_us(&sim, sim.maxLatency) > o->maxLatencyUs) {
+        fprintf(stderr, "Timepulse to LOAD latency went over %.1fus\n", o->maxLatencyUs);
+        failed = true;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -1,33 +1,68 @@
 #include "softuart.h"
+#include "config.h"
+#include "hal.h"
 
 #include <avr/io.h>
-#include <util/delay.h>
+#include <avr/interrupt.h>
 
-// Number of microseconds for a 0.5 bit delay at the desired baud rate
-// Calculated as ((1/BPS)/0.000001)/2
-#define UART_DELAY_US 49 // ~9600 baud
+// CPU cycles per bit at the desired baud rate
+#define UART_BIT_CYCLES (F_CPU / BAUD)
+
+// Cycles spent storing a bit and looping in uart_read_data_bits(), taken out of the bit delay
+#define UART_LOOP_CYCLES 8
+
+// Worst case cycles from sampling the stop bit to looking for the next start bit again, spent
+// parsing the byte and getting back round the scheduler. The GPS sends bytes back to back, so
+// this has to fit in the rest of the stop bit plus a quarter bit of lateness that still samples
+// each bit away from its edges.
+#ifndef UART_BYTE_GAP_CYCLES
+#define UART_BYTE_GAP_CYCLES 200
+#endif
+
+#if (UART_BIT_CYCLES * 3 / 4) < UART_BYTE_GAP_CYCLES
+#error "F_CPU is too slow to parse each byte before the next arrives at this BAUD"
+#endif
+
+#ifdef ENABLE_SLEEP
+// Cycles from the start bit's falling edge to the first half bit delay after waking from idle
+// sleep, over the few that uart_read_byte() takes when it is already polling:
+//
+//    3  pin change synchroniser
+//    8  wake-up from idle (4) and interrupt response (4)
+//    2  RJMP from the vector
+//  ~40  PCINT0_vect for an edge on the UART pin: saving and restoring the registers it uses,
+//       reading PINB and storing _timepulseActive
+//    4  RETI
+//  ~18  sleep_disable(), sei(), restoring PCMSK, checking PINB, calling
+//       uart_read_byte_after_wake(), and its cli() and start bit hook
+//
+// The interrupt's part depends on the registers the compiler saves. Where the timepulse calls
+// out to other functions (ENABLE_PPS_STATS, ENABLE_TELEMETRY, ENABLE_HOLDOVER) it saves all of
+// the call-clobbered ones, which adds up to ~50 cycles. A bit is 1000 cycles at 9.6MHz and 9600
+// baud, so that moves each sample by a twentieth of a bit.
+#ifndef UART_WAKE_CYCLES
+#define UART_WAKE_CYCLES 75
+#endif
+
+#if (UART_BIT_CYCLES / 2) <= UART_WAKE_CYCLES
+#error "F_CPU is too slow to wake up within half a bit at this BAUD"
+#endif
+#endif
 
 /**
- * Read a single byte transmitted by the GPS
+ * Shift in the data bits of a byte, starting half a bit into the start bit
  */
-AVRSTATIC uint8_t uart_read_byte()
+static inline uint8_t uart_read_data_bits()
 {
     uint8_t data = 0x0;
 
-    // Wait for line to go low (start bit)
-    while ((PINB & _BV(PIN_SOFT_RX)) != 0);
-
-    // 0.5 bit delay
-    _delay_us(UART_DELAY_US);
-
-    // Shift 8 data bits + 1 stop bit at the baud-rate determined by UART_DELAY_MS
+    // Shift 8 data bits + 1 stop bit at the baud-rate determined by BAUD
     uint8_t bit = 9;
     do {
         --bit;
 
         // 1 bit delay
-        _delay_us(UART_DELAY_US);
-        _delay_us(UART_DELAY_US);
+        hal_delay_cycles(UART_BIT_CYCLES - UART_LOOP_CYCLES);
 
         // If this is the stop-bit, don't try to store the value
         if (bit == 0) {
@@ -37,10 +72,60 @@ AVRSTATIC uint8_t uart_read_byte()
         // Shift to make room for next bit (reading most-significant bit first)
         data >>= 1;
 
-        if ((PINB & _BV(PIN_SOFT_RX)) != 0) {
+        if ((REG_READ(PINB) & _BV(PIN_SOFT_RX)) != 0) {
             data |= 0x80;
         }
     } while (bit != 0);
 
+#ifdef USE_INTERRUPTS
+    sei();
+#endif
+
     return data;
-}
\ No newline at end of file
+}
+
+/**
+ * Read a single byte transmitted by the GPS
+ */
+AVRSTATIC uint8_t uart_read_byte()
+{
+    // Wait for line to go low (start bit)
+    while ((REG_READ(PINB) & _BV(PIN_SOFT_RX)) != 0);
+
+#ifdef USE_INTERRUPTS
+    // An interrupt part way through would throw off the bit timing
+    // Hold interrupts off until the stop bit, delaying them by at most one byte
+    cli();
+#endif
+
+#ifdef UART_START_BIT_HOOK
+    UART_START_BIT_HOOK();
+#endif
+
+    // 0.5 bit delay
+    hal_delay_cycles(UART_BIT_CYCLES / 2);
+
+    return uart_read_data_bits();
+}
+
+#ifdef ENABLE_SLEEP
+/**
+ * Read a byte whose start bit has just woken the CPU from sleep
+ *
+ * Waking up takes a fixed number of cycles, so they're taken out of the first half bit delay
+ * to sample the start bit in the same place as uart_read_byte().
+ */
+AVRSTATIC uint8_t uart_read_byte_after_wake()
+{
+    cli();
+
+#ifdef UART_START_BIT_HOOK
+    UART_START_BIT_HOOK();
+#endif
+
+    // 0.5 bit delay, less the time taken to wake up
+    hal_delay_cycles((UART_BIT_CYCLES / 2) - UART_WAKE_CYCLES);
+
+    return uart_read_data_bits();
+}
+#endif
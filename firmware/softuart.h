@@ -4,4 +4,13 @@
 
 #define PIN_SOFT_RX PB1
 
-AVRSTATIC uint8_t uart_read_byte();
\ No newline at end of file
+// Baud rate of the GPS serial output
+#ifndef BAUD
+#define BAUD 9600
+#endif
+
+AVRSTATIC uint8_t uart_read_byte();
+
+#ifdef ENABLE_SLEEP
+AVRSTATIC uint8_t uart_read_byte_after_wake();
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+/**
+ * Telemetry records clocked out on the MAX7219 data and clock lines (ENABLE_TELEMETRY)
+ *
+ * Records are sent while LOAD is held high, so the MAX7219 only shifts them through its
+ * shift register and never latches them. Each record is a series of 16-bit words, sent
+ * MSB first like a MAX7219 command:
+ *
+ *   bits 15-12: field tag (below)
+ *   bits 11-8:  always zero, so a word latched by accident is a MAX7219 no-op
+ *   bits 7-0:   field data
+ *
+ * A record starts with kTelemetry_Start and ends with kTelemetry_Checksum, which carries
+ * the 8-bit sum of the data bytes of every word before it in the record. 16-bit values
+ * are sent as a low then high word. Times are in Timer0 ticks (TIMER0_PRESCALER CPU cycles,
+ * which is 1024 at 9.6 and 4.8MHz and 256 at 1.2MHz).
+ */
+
+#define TELEMETRY_WORD(tag, data) ((uint16_t) ((tag) << 12) | (uint8_t) (data))
+#define TELEMETRY_TAG(word) ((uint8_t) ((word) >> 12))
+#define TELEMETRY_DATA(word) ((uint8_t) (word))
+#define TELEMETRY_IS_NOOP(word) (((word) & 0x0F00) == 0)
+
+enum TelemetryTag {
+    // Start of record, data is a sequence number that increments with each record
+    kTelemetry_Start = 0xA,
+
+    // GpsReadStatus returned for the RMC sentence, always kGPS_Success
+    // Records are only sent for a valid RMC, in the quiet gap after the GPS has finished
+    // sending, so they can't delay reading the next sentence
+    kTelemetry_Status = 0x1,
+
+    // Number of sentences that have failed their checksum since start-up (wraps at 255)
+    kTelemetry_ChecksumFailures = 0x2,
+
+    // Ticks from the last timepulse to the end of the RMC sentence
+    // 0xFFFF if no timepulse was seen since the previous valid RMC sentence
+    kTelemetry_PpsOffsetLow = 0x3,
+    kTelemetry_PpsOffsetHigh = 0x4,
+
+    // Longest pass through the scheduler in ticks since the previous record
+    kTelemetry_LoopMaxLow = 0x5,
+    kTelemetry_LoopMaxHigh = 0x6,
+
+    // Number of deferred jobs that overran into UART traffic since start-up (wraps at 255)
+    kTelemetry_DeferredOverruns = 0x7,
+
+    // Ticks spent asleep since the previous record, or zero without ENABLE_SLEEP
+    kTelemetry_SleepLow = 0x8,
+    kTelemetry_SleepHigh = 0x9,
+
+    // End of record, data is the sum of all previous data bytes in the record
+    kTelemetry_Checksum = 0xF,
+};
+
+// Number of words in a record, including start and checksum
+#define TELEMETRY_RECORD_WORDS 11
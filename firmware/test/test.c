@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "../nmea.h"
+#include "../host/nmea_gen.h"
 
 static const char* g_currentSentence = NULL;
 static int g_sentenceIdx = 0;
@@ -85,6 +86,53 @@ static TestCase testcases[] = {
             .year = 19
         },
     },
+    {
+        .description = "Sentence cut short is dropped at the next start character",
+        .sentence = "$GPGSV,3,1,11$GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62\r\n",
+        .expectedStatus = kGPS_Success,
+        .expectedResult = {
+            .hour = 8,
+            .minute = 18,
+            .second = 36,
+            .day = 13,
+            .month = 9,
+            .year = 98
+        },
+    },
+    {
+        .description = "RMC sentence cut short is dropped at the next start character",
+        .sentence = "$GPRMC,0818$GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62\r\n",
+        .expectedStatus = kGPS_Success,
+        .expectedResult = {
+            .hour = 8,
+            .minute = 18,
+            .second = 36,
+            .day = 13,
+            .month = 9,
+            .year = 98
+        },
+    },
+#ifdef ENABLE_ANY_TALKER
+    {
+        .description = "RMC sentence from another talker (GN) is read",
+        .sentence = "$GNRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*7C\r\n",
+        .expectedStatus = kGPS_Success,
+        .expectedResult = {
+            .hour = 8,
+            .minute = 18,
+            .second = 36,
+            .day = 13,
+            .month = 9,
+            .year = 98
+        },
+    },
+#else
+    {
+        .description = "RMC sentence from another talker (GN) is ignored",
+        .sentence = "$GNRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*7C\r\n",
+        .expectedStatus = kGPS_NoMatch,
+    },
+#endif
     {
         .description = "Message with no time data is recognised as no signal",
         .sentence = "$GPRMC,,V,,,,,,,,,,N*53\r\n",
@@ -119,6 +167,17 @@ static TestCase testcases[] = {
         .sentence = "[something very unexpected]", // (endlessly outputs nulls at the end of the string)
         .expectedStatus = kGPS_BadFormat,
     },
+    {
+        .description = "Time and date fields with more digits than fit are rejected",
+        .sentence = "$GPRMC,2205161234567890,A,5133.82,N,00042.24,W,173.8,231.8,13069412345678,004.2,W*70\r\n",
+        .expectedStatus = kGPS_BadFormat,
+    },
+    {
+        .description = "Sentences that keep being cut short stop a read at the length limit",
+        .sentence = "$GPRMC,0818$GPRMC,0818$GPRMC,0818$GPRMC,0818$GPRMC,0818$GPRMC,0818$GPRMC,0818"
+            "$GPRMC,081836,A,3751.65,S,14507.36,E,000.0,360.0,130998,011.3,E*62\r\n",
+        .expectedStatus = kGPS_BadFormat,
+    },
     {
         .description = "Unexpected termination of valid looking sentence fails",
         .sentence = "$GPRMC,but,not,really\r\n",
@@ -187,6 +246,73 @@ bool assertPasses(TestCase* test, char** errorMsg)
     return true;
 }
 
+/**
+ * Feed the parser an hour of generated traffic with faults, one byte at a time
+ *
+ * Every intact RMC sentence with a time must be read, and nothing may be read with the wrong
+ * time. Bit errors in the line ending after the checksum don't stop a sentence being read, so
+ * a few more than the intact count can succeed.
+ */
+bool generatedTrafficPasses(char** errorMsg)
+{
+    NmeaGenConfig config;
+    nmea_gen_default_config(&config);
+    config.seed = 44;
+    config.sentences |= NMEA_GEN_SENTENCE(kNmeaGen_ZDA);
+    config.epochsPerSecond = 2;
+    config.startTime = 23 * 3600 + 30 * 60;
+    config.timeAfter = 5;
+    config.fixAfter = 20;
+    config.fixLossesPerHour = 6;
+    config.truncationRate = 0.02;
+    config.bitErrorRate = 1e-5;
+
+    NmeaGen gen;
+    nmea_gen_init(&gen, &config);
+
+    GpsParser parser = {0};
+    GpsTime output = {0};
+    uint32_t successes = 0;
+    uint32_t wrongTimes = 0;
+
+    while (gen.stats.seconds < 3600) {
+        NmeaGenEvent event;
+        nmea_gen_next(&gen, &event);
+
+        if (event.type != kNmeaGen_Byte) {
+            continue;
+        }
+
+        if (gps_parse_byte(&parser, &output, event.value) != kGPS_Success) {
+            continue;
+        }
+
+        ++successes;
+
+        if (output.hour != event.utc / 3600 || output.minute != (event.utc / 60) % 60
+            || output.second != event.utc % 60) {
+            ++wrongTimes;
+        }
+    }
+
+    const NmeaGenStats stats = gen.stats;
+    nmea_gen_free(&gen);
+
+    if (wrongTimes != 0 || successes < stats.rmcWithTime || successes > stats.rmcWithTime + stats.corrupted) {
+        asprintf(
+            errorMsg,
+            "Read %u sentences (%u with the wrong time) when %u were intact with a time",
+            successes,
+            wrongTimes,
+            stats.rmcWithTime
+        );
+
+        return false;
+    }
+
+    return true;
+}
+
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
@@ -214,5 +340,18 @@ int main()
         }
     }
 
+    const char* description = "Generated traffic with truncations, bit errors and fix loss is read";
+    char* errorMsg = NULL;
+
+    if (generatedTrafficPasses(&errorMsg)) {
+        printf(ANSI_COLOR_GREEN " ✓ " ANSI_COLOR_RESET "%s\n", description);
+    } else {
+        printf(ANSI_COLOR_RED " ✗ " ANSI_COLOR_RESET "%s\n\n", description);
+        printf(ANSI_COLOR_RED " FAILED: " ANSI_COLOR_RESET "%s\n\n", errorMsg);
+
+        free(errorMsg);
+        return 1;
+    }
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,721 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Build the firmware with its entry point renamed so the scheduler can be driven from here
+// It runs on the host backend (HAL_HOST), which emulates the peripherals in virtual time
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+#define ANSI_COLOR_RED     "\x1b[31m"
+#define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_RESET   "\x1b[0m"
+
+// Cycles between Timer0 overflows
+#define kOverflowCycles (TIMER0_PRESCALER * 256UL)
+
+#define kLightLevel 100
+
+static uint64_t ms_to_cycles(uint32_t ms)
+{
+    return (uint64_t) F_CPU * ms / 1000;
+}
+
+/**
+ * Run the scheduler until virtual time reaches a cycle
+ */
+static void run_until(uint64_t cycle)
+{
+    // Idle skips ahead to the next event, so stop there too
+    hal_host_stop_at(cycle);
+
+    while (hal_host_running()) {
+        scheduler_poll();
+    }
+
+    hal_host_stop_at(UINT64_MAX);
+}
+
+static void run_for_ms(uint32_t ms)
+{
+    run_until(hal_host_cycles() + ms_to_cycles(ms));
+}
+
+/**
+ * Power up with the timezone set to UTC in EEPROM
+ */
+static void power_up()
+{
+    hal_host_reset(F_CPU, kNumChips);
+    hal_host_eeprom()[EEPROM_TIMEZONE_ADDR] = 0;
+    hal_host_set_light(kLightLevel);
+
+    _timezoneOffset = 0;
+    _buttonHeldTicks = 0;
+    _quietTicks = 0;
+    _burstDone = false;
+    _timepulseActive = false;
+    _displayIncomplete = false;
+    _gpsParser = (GpsParser) {0};
+    _gpsTime = (GpsTime) {0};
+    _lightFiltered = 0;
+    _intensity = 0;
+}
+
+/**
+ * Power up and run main() as far as the scheduler
+ */
+static void reset_firmware()
+{
+    power_up();
+
+    hal_host_stop_at(0);
+    firmware_main();
+    hal_host_stop_at(UINT64_MAX);
+}
+
+/**
+ * Queue an RMC sentence from the GPS for a time of day and a DDMMYY date, which may be empty
+ */
+static void send_rmc_date(uint64_t cycle, uint8_t hour, uint8_t minute, uint8_t second, const char* date)
+{
+    char body[80];
+    char sentence[90];
+
+    snprintf(body, sizeof(body), "GPRMC,%02u%02u%02u.00,A,5133.82,N,00042.24,W,000.0,000.0,%s,,,A",
+        hour, minute, second, date);
+
+    uint8_t checksum = 0;
+    for (const char* c = body; *c != '\0'; ++c) {
+        checksum ^= *c;
+    }
+
+    snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+    hal_host_gps_send(cycle, sentence, strlen(sentence));
+}
+
+/**
+ * Queue an RMC sentence from the GPS for a time of day on 4th February 2019
+ */
+static void send_rmc(uint64_t cycle, uint8_t hour, uint8_t minute, uint8_t second)
+{
+    send_rmc_date(cycle, hour, minute, second, "040219");
+}
+
+/**
+ * Run a second with a timepulse at the start, followed by the RMC sentence for it
+ *
+ * Returns the seconds digit shown on the display just after the timepulse (after the end of
+ * the pulse in latch builds).
+ */
+static uint8_t simulate_second(uint8_t utcSecond)
+{
+    const uint64_t start = hal_host_cycles();
+
+    hal_host_timepulse(start, ms_to_cycles(100));
+    send_rmc(start + ms_to_cycles(30), 12, 34, utcSecond);
+
+#ifdef ENABLE_PPS_LATCH
+    // The seconds are latched when the timepulse releases LOAD
+    run_until(start + ms_to_cycles(100 + 20));
+#else
+    run_until(start + ms_to_cycles(20));
+#endif
+    const uint8_t shownOnes = max7219_model_digit(hal_host_display(), 0, kNumDigits);
+
+    run_until(start + F_CPU);
+    return shownOnes;
+}
+
+/**
+ * Run a timer overflow in the quiet gap for each light reading
+ *
+ * Returns the number of times the display intensity was changed.
+ */
+static int simulate_light(const uint8_t* readings, int numReadings, int repeat)
+{
+    int intensityWrites = 0;
+
+    for (int i = 0; i < numReadings * repeat; ++i) {
+        const uint8_t lastIntensity = _intensity;
+
+        hal_host_set_light(readings[i % numReadings]);
+        run_until(hal_host_cycles() + kOverflowCycles);
+
+        if (_intensity != lastIntensity) {
+            ++intensityWrites;
+        }
+    }
+
+    return intensityWrites;
+}
+
+static bool test_display_ticks_while_button_held(const char** error)
+{
+    reset_firmware();
+
+    // Sync up to the timepulse
+    simulate_second(0);
+    simulate_second(1);
+
+    hal_host_set_button(true);
+
+    for (uint8_t second = 2; second < 7; ++second) {
+        if (simulate_second(second) != second) {
+            *error = "The timepulse didn't show the next second while the button was held";
+            return false;
+        }
+    }
+
+    if (_timezoneOffset < 10) {
+        *error = "The timezone didn't step about twice a second while the button was held";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_timezone_saved_on_release(const char** error)
+{
+    reset_firmware();
+
+    hal_host_set_button(true);
+    simulate_second(0);
+    simulate_second(1);
+
+    if (hal_host_eeprom_writes() != 0) {
+        *error = "The timezone was written to EEPROM while the button was held";
+        return false;
+    }
+
+    hal_host_set_button(false);
+    simulate_second(2);
+
+    if (hal_host_eeprom_writes() != 1 || hal_host_eeprom()[EEPROM_TIMEZONE_ADDR] != (uint8_t) _timezoneOffset) {
+        *error = "The timezone wasn't written to EEPROM once on release";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_short_press_ignored(const char** error)
+{
+    reset_firmware();
+
+    // Just short of kButtonStepTicks overflows
+    hal_host_set_button(true);
+    run_for_ms(400);
+
+    hal_host_set_button(false);
+    run_for_ms(200);
+
+    if (_timezoneOffset != 0 || hal_host_eeprom_writes() != 0) {
+        *error = "The timezone changed before the press was debounced";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_eeprom_write_waits_for_quiet_gap(const char** error)
+{
+    reset_firmware();
+    _timezoneOffset = 5;
+
+    // A second of bytes arriving back to back from the GPS, outside of any sentence, then the RMC
+    static char noise[BAUD / 10];
+    memset(noise, 'x', sizeof(noise));
+    hal_host_gps_send(hal_host_cycles(), noise, sizeof(noise));
+    send_rmc(hal_host_cycles(), 12, 34, 0);
+
+    run_for_ms(1060);
+
+    if (hal_host_eeprom_writes() != 0) {
+        *error = "The timezone was written to EEPROM while the GPS was sending";
+        return false;
+    }
+
+    run_for_ms(200);
+
+    if (hal_host_eeprom_writes() != 1) {
+        *error = "The timezone wasn't written to EEPROM once the UART went quiet";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_eeprom_write_waits_for_late_sentences(const char** error)
+{
+    reset_firmware();
+    simulate_second(0);
+
+    // The GPS is slow to send this second's sentences, well past the timepulse
+    const uint64_t start = hal_host_cycles();
+    hal_host_timepulse(start, ms_to_cycles(100));
+    send_rmc(start + ms_to_cycles(200), 12, 34, 1);
+
+    run_until(start + ms_to_cycles(5));
+    _timezoneOffset = 5;
+    run_until(start + ms_to_cycles(195));
+
+    if (hal_host_eeprom_writes() != 0) {
+        *error = "The timezone was written to EEPROM before the GPS sent its sentences";
+        return false;
+    }
+
+    run_until(start + ms_to_cycles(600));
+
+    if (hal_host_eeprom_writes() != 1) {
+        *error = "The timezone wasn't written to EEPROM once the late sentences had been sent";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_brightness_hysteresis(const char** error)
+{
+    reset_firmware();
+
+    // Settle on a level just above the 50 boundary
+    static const uint8_t steady[] = {52};
+    simulate_light(steady, 1, 64);
+
+    if (_intensity != 2) {
+        *error = "The intensity didn't settle on the level for the light reading";
+        return false;
+    }
+
+    // The light drifting either side of the boundary, slower than the filter
+    uint8_t drifting[64];
+    for (int i = 0; i < 64; ++i) {
+        drifting[i] = i < 32 ? 48 : 53;
+    }
+
+    const int writes = simulate_light(drifting, 64, 20);
+
+    if (writes != 0) {
+        *error = "Noise around a brightness boundary changed the intensity";
+        return false;
+    }
+
+    // A step to bright light should reach its level within 32 readings
+    static const uint8_t bright[] = {150};
+    simulate_light(bright, 1, 32);
+
+    if (_intensity != 9) {
+        *error = "The intensity didn't follow a step in the light level";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_scan_limits(const char** error)
+{
+    reset_firmware();
+
+    const Max7219Model* display = hal_host_display();
+
+    // The time is on the first chip and the date uses all eight digits of the next
+    for (uint8_t chip = 0; chip < kNumChips; ++chip) {
+        const uint8_t expected = chip == 0 ? kNumDigits : 7;
+
+        if ((display->written[chip] & _BV(0x0B)) == 0 || display->registers[chip][0x0B] != expected) {
+            *error = "A MAX7219 wasn't set to scan the digits it displays";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool test_timepulse_ending_during_command(const char** error)
+{
+    reset_firmware();
+    simulate_second(0);
+
+    // End the timepulse part way through a command to the display, while LOAD is driven
+    const uint64_t start = hal_host_cycles();
+    hal_host_timepulse(start, ms_to_cycles(100));
+    send_rmc(start + ms_to_cycles(30), 12, 34, 1);
+
+    run_until(start + ms_to_cycles(100) - 50);
+    max7219_cmd(0x00, 0); // No-op register
+    run_until(start + F_CPU);
+
+    if (simulate_second(2) != 2) {
+        *error = "The timepulse after one that ended during a display command was missed";
+        return false;
+    }
+
+    return true;
+}
+
+#if kNumChips > 1
+/**
+ * Check the second chip shows a date as DD-MM-YY
+ */
+static bool date_shown(uint8_t day, uint8_t month, uint8_t year)
+{
+    const uint8_t expected[] = {day / 10, day % 10, 10, month / 10, month % 10, 10, year / 10, year % 10};
+
+    for (uint8_t i = 0; i < sizeof(expected); ++i) {
+        if (max7219_model_digit(hal_host_display(), 1, i + 1) != expected[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool test_date_follows_timezone(const char** error)
+{
+    static const struct {
+        GpsTime utc;
+        int8_t offset;
+        GpsTime local;
+    } cases[] = {
+        // Month and year ends, both ways
+        {{23, 30, 0, 31, 12, 99}, 1, {0, 30, 0, 1, 1, 0}},
+        {{0, 30, 0, 1, 1, 0}, -1, {23, 30, 0, 31, 12, 99}},
+        {{22, 0, 0, 30, 4, 19}, 3, {1, 0, 0, 1, 5, 19}},
+        {{1, 0, 0, 1, 5, 19}, -3, {22, 0, 0, 30, 4, 19}},
+
+        // February in and out of leap years
+        {{23, 0, 0, 28, 2, 24}, 2, {1, 0, 0, 29, 2, 24}},
+        {{23, 0, 0, 28, 2, 23}, 1, {0, 0, 0, 1, 3, 23}},
+        {{0, 0, 0, 1, 3, 24}, -1, {23, 0, 0, 29, 2, 24}},
+
+        // No date from the GPS
+        {{23, 0, 0, 0, 0, 0}, 1, {0, 0, 0, 0, 0, 0}},
+        {{0, 0, 0, 0, 0, 0}, -1, {23, 0, 0, 0, 0, 0}},
+    };
+
+    for (uint8_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        GpsTime time = cases[i].utc;
+
+        _timezoneOffset = cases[i].offset;
+        apply_timezone_offset(&time);
+
+        if (memcmp(&time, &cases[i].local, sizeof(time)) != 0) {
+            *error = "The date didn't follow the timezone offset across midnight";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool test_missing_date_shown_as_zeros(const char** error)
+{
+    reset_firmware();
+    _timezoneOffset = 1;
+
+    send_rmc_date(hal_host_cycles(), 12, 0, 0, "310319");
+    run_for_ms(200);
+
+    if (!date_shown(31, 3, 19)) {
+        *error = "The date wasn't shown as DD-MM-YY";
+        return false;
+    }
+
+    // The offset takes this past midnight, with no date to move on
+    send_rmc_date(hal_host_cycles(), 23, 59, 58, "");
+    run_for_ms(200);
+
+    if (max7219_model_digit(hal_host_display(), 0, 1) != 0 || max7219_model_digit(hal_host_display(), 0, 2) != 0) {
+        *error = "The time wasn't shown from a sentence without a date";
+        return false;
+    }
+
+    if (!date_shown(0, 0, 0)) {
+        *error = "A sentence without a date didn't show the date as zeros";
+        return false;
+    }
+
+    return true;
+}
+
+static int _latches = 0;
+
+static void count_latch(void* param)
+{
+    ++_latches;
+}
+
+static bool test_only_changed_digits_sent(const char** error)
+{
+    reset_firmware();
+
+    send_rmc(hal_host_cycles(), 12, 34, 56);
+    run_for_ms(200);
+
+    GpsTime time = _gpsTime;
+    hal_host_on_latch(count_latch, NULL);
+
+    // The seconds digit changes on the first chip, then the day on the second
+    for (uint8_t i = 0; i < 2; ++i) {
+        if (i == 0) {
+            ++time.second;
+        } else {
+            ++time.day;
+        }
+
+        display_buffer_update(&time);
+        _latches = 0;
+        display_buffer_send();
+
+        if (_latches != 1) {
+            *error = "Digits that hadn't changed were sent to the display again";
+            return false;
+        }
+    }
+
+    if (max7219_model_digit(hal_host_display(), 0, 6) != 7 || !date_shown(5, 2, 19)) {
+        *error = "The changed digits weren't shown";
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+#ifdef ENABLE_TELEMETRY
+static bool test_telemetry_waits_for_quiet_gap(const char** error)
+{
+    reset_firmware();
+    simulate_second(0);
+
+    const uint8_t sequence = _telemetry.sequence;
+    const uint64_t start = hal_host_cycles();
+
+    // The RMC sentence ends ~105ms after the timepulse, and the gap opens ~110ms later
+    hal_host_timepulse(start, ms_to_cycles(100));
+    send_rmc(start + ms_to_cycles(30), 12, 34, 1);
+    run_until(start + ms_to_cycles(150));
+
+    if (_telemetry.sequence != sequence || !_telemetry.recordPending) {
+        *error = "The telemetry record wasn't held back until the quiet gap";
+        return false;
+    }
+
+    run_until(start + F_CPU);
+
+    if (_telemetry.sequence != (uint8_t) (sequence + 1) || _telemetry.recordPending) {
+        *error = "A telemetry record wasn't sent once in the quiet gap";
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+// Longest host cycle stamp for each task in the README's scheduler table
+#if kNumChips > 1
+static const uint32_t kTaskHostCycles[kHalTask_Count] = {
+    [kHalTask_Timepulse] = 13700,
+    [kHalTask_UartByte] = 24300,
+    [kHalTask_Deferred] = 1900,
+    [kHalTask_Button] = 14700,
+};
+#else
+static const uint32_t kTaskHostCycles[kHalTask_Count] = {
+    [kHalTask_Timepulse] = 6000,
+    [kHalTask_UartByte] = 15400,
+#ifdef ENABLE_TELEMETRY
+    [kHalTask_Deferred] = 10100,
+#else
+    [kHalTask_Deferred] = 1100,
+#endif
+    [kHalTask_Button] = 5800,
+};
+#endif
+
+static bool test_tasks_within_wcet(const char** error)
+{
+    reset_firmware();
+
+    // Sentences that end by sending the whole display: one before any timepulse, then one with
+    // a bad checksum
+    send_rmc(hal_host_cycles(), 12, 34, 0);
+    run_for_ms(200);
+
+    static const char badChecksum[] = "$GPRMC,123400.00,A,5133.82,N,00042.24,W,000.0,000.0,040219,,,A*00\r\n";
+    hal_host_gps_send(hal_host_cycles(), badChecksum, sizeof(badChecksum) - 1);
+    run_for_ms(200);
+
+    // Hold the button to step the timezone, and swing the light to change the intensity every
+    // second, so each task takes its longest path: the timezone is saved on release, and with
+    // ENABLE_TELEMETRY a record is sent in the same quiet gap
+    for (uint8_t second = 0; second < 10; ++second) {
+        hal_host_set_button(second >= 2 && second < 5);
+        hal_host_set_light(second % 2 ? 20 : 200);
+        simulate_second(second);
+    }
+
+    for (uint8_t task = 0; task < kHalTask_Count; ++task) {
+        if (hal_host_task_max(task) == 0) {
+            *error = "A task never ran, so its WCET wasn't checked";
+            return false;
+        }
+
+        if (hal_host_task_max(task) > kTaskHostCycles[task]) {
+            *error = "A task took longer than the host cycles in the README's WCET table";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint8_t _nextSecond = 0;
+
+// Cycles from the timepulse to the RMC sentence, and how much later it comes each second
+static uint64_t _sentenceDelay = 0;
+static uint64_t _sentenceDelayStep = 0;
+
+static void queue_second(void* param)
+{
+    const uint64_t start = hal_host_cycles();
+
+    hal_host_timepulse(start, ms_to_cycles(100));
+    send_rmc(start + _sentenceDelay, 12, 34, _nextSecond);
+
+    _nextSecond = (_nextSecond + 1) % 60;
+    _sentenceDelay += _sentenceDelayStep;
+    hal_host_at(start + F_CPU, queue_second, param);
+}
+
+static uint8_t _secondsChecked = 0;
+static uint8_t _secondsWrong = 0;
+
+static void check_display(void* param)
+{
+    const Max7219Model* display = hal_host_display();
+
+    // Just before the next timepulse, the display shows the second from the last one
+    uint8_t expected[] = {1, 2, 3, 4, (_nextSecond + 59) % 60 / 10, (_nextSecond + 59) % 60 % 10};
+
+    for (uint8_t i = 0; i < kNumDigits; ++i) {
+        if ((max7219_model_digit(display, 0, i + 1) & 0x0F) != expected[i]) {
+            ++_secondsWrong;
+            break;
+        }
+    }
+
+    ++_secondsChecked;
+    hal_host_at(hal_host_cycles() + F_CPU, check_display, param);
+}
+
+/**
+ * Run main() with a timepulse and RMC sentence every second, checking the display before each
+ * timepulse
+ *
+ * Returns the number of seconds the display was wrong, or -1 if it wasn't checked every second.
+ */
+static int keep_time(uint8_t seconds, uint64_t sentenceDelay, uint64_t sentenceDelayStep)
+{
+    power_up();
+
+    // Each sentence sets the time for the timepulse after it, staying within the minute
+    _nextSecond = 0;
+    _sentenceDelay = sentenceDelay;
+    _sentenceDelayStep = sentenceDelayStep;
+    _secondsChecked = 0;
+    _secondsWrong = 0;
+
+    // The GPS starts a little after power-up, as some builds wait for the ADC before reading it
+    const uint64_t start = hal_host_cycles() + ms_to_cycles(100);
+    hal_host_at(start, queue_second, NULL);
+    hal_host_at(start + 2 * F_CPU - ms_to_cycles(10), check_display, NULL);
+    hal_host_stop_at(start + seconds * (uint64_t) F_CPU);
+
+    firmware_main();
+
+    return _secondsChecked == seconds - 1 ? _secondsWrong : -1;
+}
+
+static bool test_main_keeps_time(const char** error)
+{
+    if (keep_time(60, ms_to_cycles(30), 0) != 0) {
+        *error = "The display didn't show the time sent by the GPS every second";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_main_keeps_time_sentences_in_pulse(const char** error)
+{
+    // Sentences from 35ms after the timepulse starts, running past the end of the 100ms pulse
+    // where latch builds update the display, each 0.5ms later than the last
+    if (keep_time(60, ms_to_cycles(35), ms_to_cycles(1) / 2) != 0) {
+        *error = "The display didn't show the time from sentences that start during the timepulse";
+        return false;
+    }
+
+    return true;
+}
+
+static bool test_main_keeps_time_late_sentences(const char** error)
+{
+    // Sentences from 150ms after the timepulse, each 0.5ms later than the last so that over the
+    // minute they start across the ~27ms between two timer overflows
+    if (keep_time(60, ms_to_cycles(150), ms_to_cycles(1) / 2) != 0) {
+        *error = "The display didn't show the time from sentences sent late in the second";
+        return false;
+    }
+
+    return true;
+}
+
+typedef struct TestCase {
+    const char* description;
+    bool (*run)(const char** error);
+} TestCase;
+
+static TestCase testcases[] = {
+    {"Display keeps ticking on every timepulse while the button is held", test_display_ticks_while_button_held},
+    {"Timezone is saved to EEPROM only when the button is released", test_timezone_saved_on_release},
+    {"Button presses shorter than ~430ms are ignored", test_short_press_ignored},
+    {"EEPROM writes wait for the quiet gap after the GPS sentences", test_eeprom_write_waits_for_quiet_gap},
+    {"EEPROM writes wait for sentences sent more than 110ms after the timepulse", test_eeprom_write_waits_for_late_sentences},
+    {"Brightness only changes once the light moves past a level boundary", test_brightness_hysteresis},
+    {"Each MAX7219 scans only the digits it displays", test_scan_limits},
+    {"A timepulse that ends while a command is sent to the display is still handled", test_timepulse_ending_during_command},
+#if kNumChips > 1
+    {"The date moves with the timezone across month and year ends", test_date_follows_timezone},
+    {"An RMC sentence without a date shows the date as 00-00-00", test_missing_date_shown_as_zeros},
+    {"Only the digits that changed are sent to the chain", test_only_changed_digits_sent},
+#endif
+#ifdef ENABLE_TELEMETRY
+    {"Telemetry records are sent in the quiet gap after the RMC sentence", test_telemetry_waits_for_quiet_gap},
+#endif
+    {"Each task stays within the host cycles in the README's WCET table", test_tasks_within_wcet},
+    {"main() shows the GPS time for a minute of sentences and timepulses", test_main_keeps_time},
+    {"main() shows the GPS time when the sentences start during the timepulse and end after it", test_main_keeps_time_sentences_in_pulse},
+    {"main() shows the GPS time when the sentences come 150ms or more after the timepulse", test_main_keeps_time_late_sentences},
+};
+
+int main()
+{
+    for (int i = 0; i < (sizeof(testcases) / sizeof(testcases[0])); i++) {
+        TestCase* test = &testcases[i];
+        const char* error = NULL;
+
+        if (test->run(&error)) {
+            printf(ANSI_COLOR_GREEN " ✓ " ANSI_COLOR_RESET "%s\n", test->description);
+        } else {
+            printf(ANSI_COLOR_RED " ✗ " ANSI_COLOR_RESET "%s\n\n", test->description);
+            printf(ANSI_COLOR_RED " FAILED: " ANSI_COLOR_RESET "%s\n\n", error);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+/**
+ * Generate NMEA sentences and timepulses from a simulated GPS receiver (see ../host/nmea_gen.h)
+ *
+ * The output is either a timestamped list of bytes and timepulse edges, the raw bytes as a
+ * receiver would send them, or a VCD waveform of the UART and timepulse lines at the bit level
+ * for viewing in GTKWave or feeding to a logic analyser's pattern generator.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../host/nmea_gen.h"
+
+typedef enum Format {
+    kFormat_Bytes,
+    kFormat_Raw,
+    kFormat_Vcd,
+} Format;
+
+// VCD identifiers of the two lines
+#define kVcdRx "!"
+#define kVcdPps "\""
+
+typedef struct VcdWriter {
+    uint64_t lastTime;
+    bool started;
+
+    // Edges of the byte being sent, written out once nothing can come before them
+    uint64_t edgeTimes[10];
+    bool edgeLevels[10];
+    uint8_t numEdges;
+    uint8_t nextEdge;
+    bool rxLevel;
+} VcdWriter;
+
+static uint64_t to_ns(double seconds)
+{
+    return (uint64_t) (seconds * 1e9 + 0.5);
+}
+
+static void vcd_change(VcdWriter* vcd, uint64_t time, bool level, const char* id)
+{
+    if (!vcd->started || time != vcd->lastTime) {
+        printf("#%llu\n", (unsigned long long) time);
+        vcd->lastTime = time;
+        vcd->started = true;
+    }
+
+    printf("%d%s\n", level, id);
+}
+
+/**
+ * Write the UART edges before a time
+ */
+static void vcd_flush_rx(VcdWriter* vcd, uint64_t before)
+{
+    while (vcd->nextEdge < vcd->numEdges && vcd->edgeTimes[vcd->nextEdge] < before) {
+        vcd_change(vcd, vcd->edgeTimes[vcd->nextEdge], vcd->edgeLevels[vcd->nextEdge], kVcdRx);
+        ++vcd->nextEdge;
+    }
+}
+
+static void vcd_header(uint32_t baud)
+{
+    printf("$comment nmea-gen at %u baud $end\n", baud);
+    printf("$timescale 1ns $end\n");
+    printf("$scope module gps $end\n");
+    printf("$var wire 1 " kVcdRx " rx $end\n");
+    printf("$var wire 1 " kVcdPps " pps $end\n");
+    printf("$upscope $end\n");
+    printf("$enddefinitions $end\n");
+    printf("$dumpvars\n1" kVcdRx "\n0" kVcdPps "\n$end\n");
+}
+
+static void vcd_event(VcdWriter* vcd, const NmeaGenEvent* event, uint32_t baud)
+{
+    const uint64_t time = to_ns(event->time);
+    vcd_flush_rx(vcd, time);
+
+    if (event->type != kNmeaGen_Byte) {
+        vcd_change(vcd, time, event->type == kNmeaGen_PulseStart, kVcdPps);
+        return;
+    }
+
+    // The rest of the last byte is its stop bit, which is already high
+    vcd_flush_rx(vcd, UINT64_MAX);
+    vcd->numEdges = 0;
+    vcd->nextEdge = 0;
+
+    // Start bit, eight data bits from the least significant, then the stop bit
+    const uint16_t frame = 0x200 | (event->value << 1);
+
+    for (uint8_t bit = 0; bit < 10; ++bit) {
+        const bool level = (frame >> bit) & 1;
+
+        if (level != vcd->rxLevel) {
+            vcd->edgeTimes[vcd->numEdges] = to_ns(event->time + (double) bit / baud);
+            vcd->edgeLevels[vcd->numEdges] = level;
+            ++vcd->numEdges;
+            vcd->rxLevel = level;
+        }
+    }
+}
+
+static void print_stats(const NmeaGenStats* stats)
+{
+    fprintf(stderr,
+        "seconds=%u pulses=%u sentences=%u rmc=%u rmc_intact=%u rmc_with_time=%u truncated=%u"
+        " corrupted=%u bit_errors=%llu bytes=%llu late_epochs=%u\n",
+        stats->seconds, stats->pulses, stats->sentences, stats->rmcSentences, stats->rmcIntact,
+        stats->rmcWithTime, stats->truncated, stats->corrupted,
+        (unsigned long long) stats->bitErrors, (unsigned long long) stats->bytes, stats->lateEpochs
+    );
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -s  Seconds of traffic to generate (default 60)\n"
+        "  -f  Output format: bytes (a line per byte and timepulse edge), raw or vcd (default bytes)\n"
+        "  -S  Random seed (default 1)\n"
+        "  -t  Talker ID (default GP)\n"
+        "  -m  Sentences sent each epoch from GGA,GSA,GSV,VTG,RMC,ZDA (default GGA,GSA,GSV,VTG,RMC)\n"
+        "  -g  GSV messages per epoch, 1-4 (default 3)\n"
+        "  -r  Epochs per second, 1-10 (default 1)\n"
+        "  -b  Baud rate (default 9600)\n"
+        "  -T  UTC time and date of the first second as hhmmss,ddmmyy (default 120000,040219)\n"
+        "  -a  Seconds until the time is known (default 0)\n"
+        "  -A  Seconds until there's a fix (default 0)\n"
+        "  -l  Fix losses per hour (default 0)\n"
+        "  -L  Longest fix loss in seconds (default 30)\n"
+        "  -d  Milliseconds from each epoch to its first sentence (default 30)\n"
+        "  -J  Largest extra random sentence delay in milliseconds (default 0)\n"
+        "  -o  Timepulse offset from the true second in milliseconds (default 0)\n"
+        "  -j  Largest timepulse jitter either way in microseconds (default 0)\n"
+        "  -w  Timepulse width in milliseconds (default 100)\n"
+        "  -P  Keep sending timepulses without a fix\n"
+        "  -x  Chance of each sentence being cut short (default 0)\n"
+        "  -e  Bit error rate (default 0)\n"
+        "  -v  Print totals to stderr at the end\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    NmeaGenConfig config;
+    nmea_gen_default_config(&config);
+
+    double seconds = 60;
+    Format format = kFormat_Bytes;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:S:t:m:g:r:b:T:a:A:l:L:d:J:o:j:w:Px:e:vh")) != -1) {
+        switch (opt) {
+            case 's': seconds = atof(optarg); break;
+            case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+            case 'g': config.gsvMessages = atoi(optarg); break;
+            case 'r': config.epochsPerSecond = atoi(optarg); break;
+            case 'b': config.baud = strtoul(optarg, NULL, 10); break;
+            case 'a': config.timeAfter = atof(optarg); break;
+            case 'A': config.fixAfter = atof(optarg); break;
+            case 'l': config.fixLossesPerHour = atof(optarg); break;
+            case 'L': config.fixLossSeconds = atof(optarg); break;
+            case 'd': config.sentenceDelay = atof(optarg) / 1e3; break;
+            case 'J': config.sentenceJitter = atof(optarg) / 1e3; break;
+            case 'o': config.ppsOffset = atof(optarg) / 1e3; break;
+            case 'j': config.ppsJitter = atof(optarg) / 1e6; break;
+            case 'w': config.ppsWidth = atof(optarg) / 1e3; break;
+            case 'P': config.ppsWithoutFix = true; break;
+            case 'x': config.truncationRate = atof(optarg); break;
+            case 'e': config.bitErrorRate = atof(optarg); break;
+            case 'v': verbose = true; break;
+
+            case 'f':
+                if (strcmp(optarg, "bytes") == 0) {
+                    format = kFormat_Bytes;
+                } else if (strcmp(optarg, "raw") == 0) {
+                    format = kFormat_Raw;
+                } else if (strcmp(optarg, "vcd") == 0) {
+                    format = kFormat_Vcd;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+
+            case 't':
+                if (strlen(optarg) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                memcpy(config.talker, optarg, 3);
+                break;
+
+            case 'm':
+                if (!nmea_gen_parse_sentences(optarg, &config.sentences)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+
+            case 'T': {
+                unsigned int time, date;
+                if (sscanf(optarg, "%6u,%6u", &time, &date) != 2) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                config.startTime = (time / 10000) * 3600 + ((time / 100) % 100) * 60 + time % 100;
+                config.day = date / 10000;
+                config.month = (date / 100) % 100;
+                config.year = date % 100;
+                break;
+            }
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (config.baud == 0 || config.epochsPerSecond < 1 || config.epochsPerSecond > 10
+        || config.gsvMessages < 1 || config.gsvMessages > 4) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    NmeaGen gen;
+    nmea_gen_init(&gen, &config);
+
+    VcdWriter vcd = { .rxLevel = true };
+
+    if (format == kFormat_Vcd) {
+        vcd_header(config.baud);
+    }
+
+    while (nmea_gen_peek(&gen)->time < seconds) {
+        NmeaGenEvent event;
+        nmea_gen_next(&gen, &event);
+
+        switch (format) {
+            case kFormat_Bytes:
+                if (event.type == kNmeaGen_Byte) {
+                    printf("%.7f rx %02X\n", event.time, event.value);
+                } else {
+                    printf("%.7f pps %d\n", event.time, event.type == kNmeaGen_PulseStart);
+                }
+                break;
+
+            case kFormat_Raw:
+                if (event.type == kNmeaGen_Byte) {
+                    putchar(event.value);
+                }
+                break;
+
+            case kFormat_Vcd:
+                vcd_event(&vcd, &event, config.baud);
+                break;
+        }
+    }
+
+    if (format == kFormat_Vcd) {
+        vcd_flush_rx(&vcd, UINT64_MAX);
+    }
+
+    if (verbose) {
+        print_stats(&gen.stats);
+    }
+
+    nmea_gen_free(&gen);
+    return 0;
+}
@@ -0,0 +1,485 @@
+/**
+ * Replay a recorded NMEA log through the firmware's sentence parser (../nmea.c)
+ *
+ * The log is memory mapped and split into chunks at '$' characters, which are shared out
+ * between worker threads. A '$' always resets the parser, so each chunk can be parsed on its
+ * own from a fresh parser and gives exactly the results of parsing the whole log in one go.
+ * The report has the count of each GpsReadStatus, the bytes read per successful decode, the
+ * mix of sentence types and the longest gaps between successful decodes by GPS time.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../nmea.h"
+
+// Chunks per worker thread, so threads that finish early can take more work
+#define kChunksPerJob 16
+
+// Longest gaps kept per chunk and reported
+#define kMaxGaps 10
+
+// Distinct sentence types counted, in a hash table of twice this size
+#define kMaxSentenceTypes 256
+#define kSentenceTypeSlots (kMaxSentenceTypes * 2)
+
+// Sentence types listed in the report, the rest being added up as other
+#define kReportedTypes 16
+
+// Talker ID and type after the '$', eg. GPRMC
+#define kSentenceTypeLength 5
+
+static const char* statusToString[] = {
+    "kGPS_Success",
+    "kGPS_NoSignal",
+    "kGPS_NoMatch",
+    "kGPS_InvalidChecksum",
+    "kGPS_BadFormat",
+};
+
+#define kNumStatuses (sizeof(statusToString) / sizeof(statusToString[0]))
+
+typedef struct Decode {
+    size_t offset; // Of the byte that completed the sentence
+    int64_t time; // GPS seconds since 2000-01-01
+} Decode;
+
+typedef struct Gap {
+    Decode from;
+    Decode to;
+} Gap;
+
+typedef struct SentenceType {
+    uint64_t key; // Characters packed into the low bytes, zero for an empty slot
+    uint64_t count;
+} SentenceType;
+
+typedef struct ChunkResult {
+    uint64_t statuses[kNumStatuses];
+    uint64_t sentences;
+    uint64_t otherTypes; // Sentences with a type that isn't five letters or digits, or past the table
+
+    SentenceType types[kSentenceTypeSlots];
+    uint32_t numTypes;
+
+    bool decoded;
+    Decode first;
+    Decode last;
+
+    // Longest first
+    Gap gaps[kMaxGaps];
+    uint8_t numGaps;
+} ChunkResult;
+
+typedef struct Replay {
+    const uint8_t* data;
+    size_t size;
+
+    size_t* chunkStarts; // numChunks + 1 entries, the last being size
+    ChunkResult* results;
+    uint32_t numChunks;
+
+    pthread_mutex_t lock;
+    uint32_t nextChunk;
+} Replay;
+
+/**
+ * nmea.c's gps_read_time() reads from the UART. The replay feeds gps_parse_byte() instead,
+ * which is what the firmware's scheduler calls, so this is never used.
+ */
+uint8_t uart_read_byte()
+{
+    return '\n';
+}
+
+/**
+ * Days from 2000-01-01 to a date in 2000-2099
+ */
+static int64_t days_since_2000(const GpsTime* t)
+{
+    // Count years from March so the leap day is at the end of each
+    const int year = 2000 + t->year - (t->month <= 2);
+    const int month = t->month <= 2 ? t->month + 9 : t->month - 3;
+    const int64_t days = 365L * year + year / 4 - year / 100 + year / 400 + (153 * month + 2) / 5 + t->day - 1;
+
+    // The same count for 2000-01-01
+    return days - 730425;
+}
+
+static int64_t gps_seconds(const GpsTime* t)
+{
+    return days_since_2000(t) * 86400 + t->hour * 3600 + t->minute * 60 + t->second;
+}
+
+static int64_t gap_seconds(const Gap* gap)
+{
+    return gap->to.time - gap->from.time;
+}
+
+/**
+ * Keep a gap if it's one of the longest seen
+ */
+static void add_gap(Gap* gaps, uint8_t* numGaps, const Gap* gap)
+{
+    const int64_t seconds = gap_seconds(gap);
+
+    if (*numGaps == kMaxGaps && seconds <= gap_seconds(&gaps[kMaxGaps - 1])) {
+        return;
+    }
+
+    uint8_t i = *numGaps < kMaxGaps ? (*numGaps)++ : kMaxGaps - 1;
+
+    while (i > 0 && gap_seconds(&gaps[i - 1]) < seconds) {
+        gaps[i] = gaps[i - 1];
+        --i;
+    }
+
+    gaps[i] = *gap;
+}
+
+static void count_type(ChunkResult* result, uint64_t key, uint64_t count)
+{
+    uint32_t slot = (key * 0x9E3779B97F4A7C15ULL) >> 55;
+
+    while (result->types[slot].key != 0 && result->types[slot].key != key) {
+        slot = (slot + 1) % kSentenceTypeSlots;
+    }
+
+    if (result->types[slot].key == 0) {
+        if (result->numTypes == kMaxSentenceTypes) {
+            result->otherTypes += count;
+            return;
+        }
+
+        result->types[slot].key = key;
+        ++result->numTypes;
+    }
+
+    result->types[slot].count += count;
+}
+
+/**
+ * Count the sentence type following a '$'
+ */
+static void count_sentence(const Replay* replay, ChunkResult* result, size_t offset)
+{
+    ++result->sentences;
+
+    uint64_t key = 0;
+
+    for (uint8_t i = 0; i < kSentenceTypeLength; ++i) {
+        const size_t pos = offset + 1 + i;
+        const uint8_t c = pos < replay->size ? replay->data[pos] : 0;
+
+        if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))) {
+            ++result->otherTypes;
+            return;
+        }
+
+        key |= (uint64_t) c << (i * 8);
+    }
+
+    count_type(result, key, 1);
+}
+
+static void replay_chunk(const Replay* replay, uint32_t chunk)
+{
+    ChunkResult* result = &replay->results[chunk];
+    const size_t end = replay->chunkStarts[chunk + 1];
+
+    GpsParser parser = {0};
+    GpsTime output = {0};
+
+    for (size_t offset = replay->chunkStarts[chunk]; offset < end; ++offset) {
+        const char byte = replay->data[offset];
+
+        if (byte == '$') {
+            count_sentence(replay, result, offset);
+        }
+
+        const GpsReadStatus status = gps_parse_byte(&parser, &output, byte);
+
+        if (status == kGPS_InProgress) {
+            continue;
+        }
+
+        ++result->statuses[status];
+
+        if (status != kGPS_Success) {
+            continue;
+        }
+
+        const Decode decode = { .offset = offset, .time = gps_seconds(&output) };
+
+        if (!result->decoded) {
+            result->first = decode;
+            result->decoded = true;
+        } else {
+            add_gap(result->gaps, &result->numGaps, &(Gap) { result->last, decode });
+        }
+
+        result->last = decode;
+    }
+}
+
+static void* worker(void* param)
+{
+    Replay* replay = param;
+
+    for (;;) {
+        pthread_mutex_lock(&replay->lock);
+        const uint32_t chunk = replay->nextChunk++;
+        pthread_mutex_unlock(&replay->lock);
+
+        if (chunk >= replay->numChunks) {
+            return NULL;
+        }
+
+        replay_chunk(replay, chunk);
+    }
+}
+
+/**
+ * Divide the log into chunks that each start at a '$'
+ */
+static void split_chunks(Replay* replay, uint32_t wanted)
+{
+    replay->chunkStarts = malloc((wanted + 1) * sizeof(size_t));
+    replay->numChunks = 0;
+
+    if (replay->size != 0) {
+        replay->chunkStarts[replay->numChunks++] = 0;
+    }
+
+    for (uint32_t i = 1; i < wanted; ++i) {
+        const size_t target = replay->size / wanted * i;
+
+        // Sentences can be longer than a chunk in a tiny log
+        if (replay->numChunks == 0 || target <= replay->chunkStarts[replay->numChunks - 1]) {
+            continue;
+        }
+
+        const uint8_t* next = memchr(replay->data + target, '$', replay->size - target);
+        if (next == NULL) {
+            break;
+        }
+
+        replay->chunkStarts[replay->numChunks++] = next - replay->data;
+    }
+
+    replay->chunkStarts[replay->numChunks] = replay->size;
+}
+
+static void print_type(uint64_t key, uint64_t count, uint64_t sentences)
+{
+    char name[kSentenceTypeLength + 1] = {0};
+
+    for (uint8_t i = 0; i < kSentenceTypeLength; ++i) {
+        name[i] = (char) (key >> (i * 8));
+    }
+
+    printf("    %-8s %12llu  %5.1f%%\n", key == 0 ? "(other)" : name, (unsigned long long) count,
+        sentences ? 100.0 * count / sentences : 0);
+}
+
+static int compare_types(const void* a, const void* b)
+{
+    const uint64_t ca = ((const SentenceType*) a)->count;
+    const uint64_t cb = ((const SentenceType*) b)->count;
+
+    return (ca < cb) - (ca > cb);
+}
+
+static void print_time(int64_t seconds)
+{
+    const time_t t = (time_t) seconds + 946684800; // 2000-01-01 in Unix time
+    struct tm utc;
+    gmtime_r(&t, &utc);
+
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &utc);
+    printf("%s", text);
+}
+
+static void print_report(const Replay* replay, double elapsed)
+{
+    // Add up the chunks in order, joining gaps that span a chunk boundary
+    ChunkResult* total = calloc(1, sizeof(ChunkResult));
+
+    for (uint32_t i = 0; i < replay->numChunks; ++i) {
+        const ChunkResult* result = &replay->results[i];
+
+        for (size_t s = 0; s < kNumStatuses; ++s) {
+            total->statuses[s] += result->statuses[s];
+        }
+
+        total->sentences += result->sentences;
+        total->otherTypes += result->otherTypes;
+
+        for (uint32_t slot = 0; slot < kSentenceTypeSlots; ++slot) {
+            if (result->types[slot].key != 0) {
+                count_type(total, result->types[slot].key, result->types[slot].count);
+            }
+        }
+
+        if (!result->decoded) {
+            continue;
+        }
+
+        if (total->decoded) {
+            add_gap(total->gaps, &total->numGaps, &(Gap) { total->last, result->first });
+        } else {
+            total->first = result->first;
+            total->decoded = true;
+        }
+
+        for (uint8_t g = 0; g < result->numGaps; ++g) {
+            add_gap(total->gaps, &total->numGaps, &result->gaps[g]);
+        }
+
+        total->last = result->last;
+    }
+
+    const uint64_t successes = total->statuses[kGPS_Success];
+
+    printf("Replayed %zu bytes in %.2fs (%.0f MB/s)\n", replay->size, elapsed,
+        elapsed > 0 ? replay->size / elapsed / 1e6 : 0);
+
+    printf("  Results:\n");
+    for (size_t s = 0; s < kNumStatuses; ++s) {
+        printf("    %-22s %12llu\n", statusToString[s], (unsigned long long) total->statuses[s]);
+    }
+
+    if (successes != 0) {
+        printf("  Bytes per success: %.1f\n", (double) replay->size / successes);
+    } else {
+        printf("  Bytes per success: none decoded\n");
+    }
+
+    printf("  Sentences: %llu\n", (unsigned long long) total->sentences);
+
+    qsort(total->types, kSentenceTypeSlots, sizeof(SentenceType), compare_types);
+    for (uint32_t i = 0; i < total->numTypes; ++i) {
+        if (i < kReportedTypes) {
+            print_type(total->types[i].key, total->types[i].count, total->sentences);
+        } else {
+            total->otherTypes += total->types[i].count;
+        }
+    }
+
+    if (total->otherTypes != 0) {
+        print_type(0, total->otherTypes, total->sentences);
+    }
+
+    if (total->decoded) {
+        printf("  Decoded times from ");
+        print_time(total->first.time);
+        printf(" to ");
+        print_time(total->last.time);
+        printf("\n");
+    }
+
+    printf("  Longest gaps between successes:\n");
+    for (uint8_t g = 0; g < total->numGaps; ++g) {
+        const Gap* gap = &total->gaps[g];
+
+        printf("    %8llds after ", (long long) gap_seconds(gap));
+        print_time(gap->from.time);
+        printf(" (bytes %zu to %zu)\n", gap->from.offset, gap->to.offset);
+    }
+
+    free(total);
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [-j jobs] log\n"
+        "  -j  Worker threads (default the number of CPUs)\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:h")) != -1) {
+        switch (opt) {
+            case 'j':
+                jobs = strtol(optarg, NULL, 10);
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1 || jobs < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[optind];
+    const int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    Replay replay = { .size = info.st_size, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+    if (replay.size != 0) {
+        replay.data = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (replay.data == MAP_FAILED) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            return 1;
+        }
+
+        madvise((void*) replay.data, replay.size, MADV_SEQUENTIAL);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    split_chunks(&replay, jobs * kChunksPerJob);
+    replay.results = calloc(replay.numChunks ? replay.numChunks : 1, sizeof(ChunkResult));
+
+    pthread_t* threads = malloc(jobs * sizeof(pthread_t));
+    for (long i = 0; i < jobs; ++i) {
+        pthread_create(&threads[i], NULL, worker, &replay);
+    }
+
+    for (long i = 0; i < jobs; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    print_report(&replay, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    free(threads);
+    free(replay.results);
+    free(replay.chunkStarts);
+
+    if (replay.size != 0) {
+        munmap((void*) replay.data, replay.size);
+    }
+
+    close(fd);
+    return 0;
+}
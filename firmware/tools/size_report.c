@@ -0,0 +1,384 @@
+/**
+ * Break the firmware's flash and RAM down by symbol and check them against a budget
+ *
+ * Reads the output section sizes from the linker map (main.map) and the size of each function
+ * and static from `avr-nm --size-sort -S`. Flash is .text plus the initial values of .data, and
+ * RAM is .data, .bss and .noinit, with what's left of the RAM being the stack's headroom. The
+ * budget file has a line per limit (see budget.txt), and the exit status is non-zero if any is
+ * exceeded. With -w, a budget is written from the current sizes instead.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Memory of the ATtiny13A
+#define kFlashBytes 1024
+#define kRamBytes 64
+
+#define kMaxSymbols 256
+#define kMaxBudgets 256
+#define kMaxName 64
+
+typedef struct Symbol {
+    char name[kMaxName];
+    uint32_t size;
+    bool flash; // In flash, otherwise in RAM
+} Symbol;
+
+typedef struct Budget {
+    char name[kMaxName];
+    uint32_t bytes;
+} Budget;
+
+typedef struct Sizes {
+    uint32_t text;
+    uint32_t data;
+    uint32_t bss;
+    uint32_t noinit;
+
+    Symbol symbols[kMaxSymbols];
+    uint32_t numSymbols;
+} Sizes;
+
+typedef struct Budgets {
+    Budget entries[kMaxBudgets];
+    uint32_t count;
+} Budgets;
+
+/**
+ * Read the sizes of the output sections from a GNU ld map file
+ *
+ * An output section is listed at the start of a line with its address and size, or with them
+ * on the next line if its name is long.
+ */
+static bool read_map(const char* path, Sizes* sizes)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[512];
+    char section[kMaxName] = "";
+    bool found = false;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned long address;
+        unsigned long size;
+        char name[kMaxName];
+
+        if (line[0] == '.') {
+            const int fields = sscanf(line, "%63s 0x%lx 0x%lx", name, &address, &size);
+
+            if (fields == 1) {
+                strcpy(section, name);
+                continue;
+            }
+
+            if (fields != 3) {
+                continue;
+            }
+        } else if (section[0] != '\0' && sscanf(line, " 0x%lx 0x%lx", &address, &size) == 2) {
+            strcpy(name, section);
+        } else {
+            section[0] = '\0';
+            continue;
+        }
+
+        section[0] = '\0';
+
+        if (strcmp(name, ".text") == 0) {
+            sizes->text = size;
+            found = true;
+        } else if (strcmp(name, ".data") == 0) {
+            sizes->data = size;
+        } else if (strcmp(name, ".bss") == 0) {
+            sizes->bss = size;
+        } else if (strcmp(name, ".noinit") == 0) {
+            sizes->noinit = size;
+        }
+    }
+
+    fclose(file);
+
+    if (!found) {
+        fprintf(stderr, "No .text section in %s\n", path);
+    }
+
+    return found;
+}
+
+/**
+ * Read the symbols with a size from `avr-nm -S` output (address, size, type and name per line)
+ */
+static bool read_symbols(const char* path, Sizes* sizes)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[512];
+
+    while (fgets(line, sizeof(line), file) != NULL && sizes->numSymbols < kMaxSymbols) {
+        unsigned long address;
+        unsigned long size;
+        char type;
+        char name[kMaxName];
+
+        if (sscanf(line, "%lx %lx %c %63s", &address, &size, &type, name) != 4) {
+            continue;
+        }
+
+        Symbol* symbol = &sizes->symbols[sizes->numSymbols];
+
+        switch (type) {
+            case 't': case 'T': case 'w': case 'W':
+                symbol->flash = true;
+                break;
+
+            case 'd': case 'D': case 'b': case 'B': case 'v': case 'V':
+                symbol->flash = false;
+                break;
+
+            default:
+                continue;
+        }
+
+        strcpy(symbol->name, name);
+        symbol->size = size;
+        ++sizes->numSymbols;
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool read_budgets(const char* path, Budgets* budgets)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[512];
+    uint32_t lineNumber = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ++lineNumber;
+
+        char name[kMaxName];
+        unsigned long bytes;
+        const char* start = line + strspn(line, " \t");
+
+        if (*start == '#' || *start == '\n' || *start == '\0') {
+            continue;
+        }
+
+        if (sscanf(start, "%63s %lu", name, &bytes) != 2 || budgets->count == kMaxBudgets) {
+            fprintf(stderr, "%s:%u: expected a name and a number of bytes\n", path, lineNumber);
+            fclose(file);
+            return false;
+        }
+
+        strcpy(budgets->entries[budgets->count].name, name);
+        budgets->entries[budgets->count].bytes = bytes;
+        ++budgets->count;
+    }
+
+    fclose(file);
+    return true;
+}
+
+static const Budget* find_budget(const Budgets* budgets, const char* name)
+{
+    for (uint32_t i = 0; i < budgets->count; ++i) {
+        if (strcmp(budgets->entries[i].name, name) == 0) {
+            return &budgets->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Print a size with its budget, returning false if it's over
+ *
+ * The headroom budget is a minimum rather than a maximum.
+ */
+static bool print_size(const Budgets* budgets, const char* indent, const char* name, uint32_t size)
+{
+    const Budget* budget = find_budget(budgets, name);
+    const bool minimum = strcmp(name, "headroom") == 0;
+
+    printf("%s%-28s %5u", indent, name, size);
+
+    if (budget == NULL) {
+        printf("\n");
+        return true;
+    }
+
+    const bool over = minimum ? size < budget->bytes : size > budget->bytes;
+
+    printf("  (%s %u)%s\n", minimum ? "at least" : "budget", budget->bytes, over ? "  OVER BUDGET" : "");
+    return !over;
+}
+
+/**
+ * Count the symbols the budget has no line for, which only the totals limit
+ */
+static uint32_t count_unbudgeted(const Sizes* sizes, const Budgets* budgets)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < sizes->numSymbols; ++i) {
+        if (find_budget(budgets, sizes->symbols[i].name) == NULL) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+static bool print_symbols(const Sizes* sizes, const Budgets* budgets, bool flash)
+{
+    bool passed = true;
+
+    // avr-nm --size-sort lists the smallest first
+    for (uint32_t i = sizes->numSymbols; i != 0; --i) {
+        const Symbol* symbol = &sizes->symbols[i - 1];
+
+        if (symbol->flash == flash) {
+            passed &= print_size(budgets, "    ", symbol->name, symbol->size);
+        }
+    }
+
+    return passed;
+}
+
+static bool write_budgets(const char* path, const Sizes* sizes, uint32_t ramBytes)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+
+    const uint32_t ram = sizes->data + sizes->bss + sizes->noinit;
+
+    fprintf(file, "# Size budgets for `make budget` (see tools/size_report.c), one limit in bytes per line:\n");
+    fprintf(file, "# flash and ram for the totals, headroom for the least RAM left for the stack, and\n");
+    fprintf(file, "# the name of a function or static for its own size. Written by `make budget-update`\n");
+    fprintf(file, "flash %u\n", sizes->text + sizes->data);
+    fprintf(file, "ram %u\n", ram);
+    fprintf(file, "headroom %u\n", ramBytes > ram ? ramBytes - ram : 0);
+
+    for (uint32_t i = sizes->numSymbols; i != 0; --i) {
+        fprintf(file, "%s %u\n", sizes->symbols[i - 1].name, sizes->symbols[i - 1].size);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s -m main.map -n symbols.txt [-b budget.txt] [-w budget.txt] [-f bytes] [-r bytes]\n"
+        "  -m  Linker map of the firmware\n"
+        "  -n  Output of avr-nm --size-sort -S for the firmware\n"
+        "  -b  Fail if a size in this budget is exceeded\n"
+        "  -w  Write the current sizes to this file as a budget\n"
+        "  -f  Flash size (default %u)\n"
+        "  -r  RAM size (default %u)\n",
+        name, kFlashBytes, kRamBytes
+    );
+}
+
+int main(int argc, char** argv)
+{
+    const char* mapPath = NULL;
+    const char* symbolsPath = NULL;
+    const char* budgetPath = NULL;
+    const char* writePath = NULL;
+    uint32_t flashBytes = kFlashBytes;
+    uint32_t ramBytes = kRamBytes;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:n:b:w:f:r:h")) != -1) {
+        switch (opt) {
+            case 'm': mapPath = optarg; break;
+            case 'n': symbolsPath = optarg; break;
+            case 'b': budgetPath = optarg; break;
+            case 'w': writePath = optarg; break;
+            case 'f': flashBytes = strtoul(optarg, NULL, 10); break;
+            case 'r': ramBytes = strtoul(optarg, NULL, 10); break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (mapPath == NULL || symbolsPath == NULL || optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static Sizes sizes;
+    static Budgets budgets;
+
+    if (!read_map(mapPath, &sizes) || !read_symbols(symbolsPath, &sizes)) {
+        return 1;
+    }
+
+    if (writePath != NULL) {
+        return write_budgets(writePath, &sizes, ramBytes) ? 0 : 1;
+    }
+
+    if (budgetPath != NULL && !read_budgets(budgetPath, &budgets)) {
+        return 1;
+    }
+
+    const uint32_t flash = sizes.text + sizes.data;
+    const uint32_t ram = sizes.data + sizes.bss + sizes.noinit;
+    const uint32_t headroom = ramBytes > ram ? ramBytes - ram : 0;
+    bool passed = true;
+
+    printf("Flash: %u of %u bytes (.text %u, .data initial values %u)\n", flash, flashBytes, sizes.text, sizes.data);
+    passed &= print_size(&budgets, "  ", "flash", flash);
+    passed &= print_symbols(&sizes, &budgets, true);
+
+    printf("RAM: %u of %u bytes (.data %u, .bss %u, .noinit %u)\n", ram, ramBytes, sizes.data, sizes.bss, sizes.noinit);
+    passed &= print_size(&budgets, "  ", "ram", ram);
+    passed &= print_symbols(&sizes, &budgets, false);
+
+    printf("Stack: %u bytes of RAM left\n", headroom);
+    passed &= print_size(&budgets, "  ", "headroom", headroom);
+
+    // Say so rather than pass quietly, as a symbol without a line can grow until a total is hit
+    const uint32_t unbudgeted = count_unbudgeted(&sizes, &budgets);
+
+    if (budgetPath != NULL && unbudgeted != 0) {
+        printf("%u of %u symbols have no budget of their own in %s: `make budget-update` adds them\n",
+            unbudgeted, sizes.numSymbols, budgetPath);
+    }
+
+    if (flash > flashBytes || ram > ramBytes) {
+        printf("The firmware doesn't fit in the device\n");
+        passed = false;
+    }
+
+    if (!passed) {
+        printf("Over budget: %s\n", budgetPath != NULL ? budgetPath : "device size");
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+/**
+ * Decode telemetry records clocked out on the MAX7219 lines by ENABLE_TELEMETRY builds
+ *
+ * Reads either a logic analyser capture exported as CSV (one sample per line with a column
+ * each for MOSI, SCK and LOAD, as written by `sigrok-cli -O csv`), or with -w a list of
+ * 16-bit hex words that were clocked out while LOAD was high (one per line).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../telemetry.h"
+
+static const char* statusToString[] = {
+    "kGPS_Success",
+    "kGPS_NoSignal",
+    "kGPS_NoMatch",
+    "kGPS_InvalidChecksum",
+    "kGPS_BadFormat",
+};
+
+typedef struct Decoder {
+    // Record being collected
+    uint8_t fields[TELEMETRY_RECORD_WORDS - 1];
+    uint8_t numFields;
+    uint8_t sum;
+
+    // CPU frequency to convert ticks to milliseconds
+    double cpuFrequency;
+
+    unsigned int numRecords;
+    unsigned int numErrors;
+} Decoder;
+
+/**
+ * Timer0 prescaler the firmware uses at a CPU frequency (TIMER0_PRESCALER in config.h)
+ */
+static double timer0_prescaler(double cpuFrequency)
+{
+    return cpuFrequency > 1200000 ? 1024.0 : 256.0;
+}
+
+static double ticks_to_ms(const Decoder* decoder, uint16_t ticks)
+{
+    return ticks * timer0_prescaler(decoder->cpuFrequency) * 1000.0 / decoder->cpuFrequency;
+}
+
+static void print_record(const Decoder* decoder)
+{
+    const uint8_t* f = decoder->fields;
+    const uint8_t status = f[kTelemetry_Status];
+    const uint16_t ppsOffset = f[kTelemetry_PpsOffsetLow] | (f[kTelemetry_PpsOffsetHigh] << 8);
+    const uint16_t loopMax = f[kTelemetry_LoopMaxLow] | (f[kTelemetry_LoopMaxHigh] << 8);
+    const uint16_t sleep = f[kTelemetry_SleepLow] | (f[kTelemetry_SleepHigh] << 8);
+
+    printf("seq=%u status=%s checksum_failures=%u",
+        f[0],
+        status < (sizeof(statusToString) / sizeof(statusToString[0])) ? statusToString[status] : "?",
+        f[kTelemetry_ChecksumFailures]
+    );
+
+    if (ppsOffset == 0xFFFF) {
+        printf(" pps_offset=none");
+    } else {
+        printf(" pps_offset=%u (%.1fms)", ppsOffset, ticks_to_ms(decoder, ppsOffset));
+    }
+
+    printf(" loop_max=%u (%.1fms)", loopMax, ticks_to_ms(decoder, loopMax));
+    printf(" deferred_overruns=%u", f[kTelemetry_DeferredOverruns]);
+    printf(" sleep=%u (%.1fms)\n", sleep, ticks_to_ms(decoder, sleep));
+}
+
+/**
+ * Feed a word that was clocked out while LOAD was high
+ */
+static void decode_word(Decoder* decoder, uint16_t word)
+{
+    if (!TELEMETRY_IS_NOOP(word)) {
+        // A display command preloaded for the timepulse to latch, not telemetry
+        return;
+    }
+
+    const uint8_t tag = TELEMETRY_TAG(word);
+    const uint8_t data = TELEMETRY_DATA(word);
+
+    if (tag == kTelemetry_Start) {
+        if (decoder->numFields != 0) {
+            // Previous record was cut short
+            ++decoder->numErrors;
+        }
+
+        decoder->fields[0] = data;
+        decoder->numFields = 1;
+        decoder->sum = data;
+        return;
+    }
+
+    if (decoder->numFields == 0) {
+        // Not in a record
+        return;
+    }
+
+    if (tag == kTelemetry_Checksum && decoder->numFields == (TELEMETRY_RECORD_WORDS - 1)) {
+        if (data == decoder->sum) {
+            ++decoder->numRecords;
+            print_record(decoder);
+        } else {
+            ++decoder->numErrors;
+            fprintf(stderr, "Checksum mismatch in record %u\n", decoder->fields[0]);
+        }
+
+        decoder->numFields = 0;
+        return;
+    }
+
+    if (tag != decoder->numFields) {
+        // Fields arrive in tag order: anything else means bits were lost
+        ++decoder->numErrors;
+        decoder->numFields = 0;
+        return;
+    }
+
+    decoder->fields[decoder->numFields++] = data;
+    decoder->sum += data;
+}
+
+static void decode_words(Decoder* decoder, FILE* input)
+{
+    char line[256];
+
+    while (fgets(line, sizeof(line), input) != NULL) {
+        char* end;
+        const unsigned long word = strtoul(line, &end, 16);
+
+        if (end != line) {
+            decode_word(decoder, word);
+        }
+    }
+}
+
+static void decode_samples(Decoder* decoder, FILE* input, const int columns[3])
+{
+    char line[1024];
+
+    bool lastClock = false;
+    bool lastLoad = true;
+    uint16_t shift = 0;
+    unsigned int numBits = 0;
+
+    while (fgets(line, sizeof(line), input) != NULL) {
+        // Skip comments and headers
+        if (line[0] < '0' || line[0] > '9') {
+            continue;
+        }
+
+        int values[16] = {0};
+        int numValues = 0;
+
+        for (char* tok = strtok(line, ",\r\n"); tok != NULL && numValues < 16; tok = strtok(NULL, ",\r\n")) {
+            values[numValues++] = atoi(tok);
+        }
+
+        const bool mosi = values[columns[0]] != 0;
+        const bool clock = values[columns[1]] != 0;
+        const bool load = values[columns[2]] != 0;
+
+        if (clock && !lastClock) {
+            shift = (shift << 1) | mosi;
+
+            if (++numBits == 16) {
+                numBits = 0;
+
+                if (load) {
+                    decode_word(decoder, shift);
+                }
+            }
+        }
+
+        if (load && !lastLoad) {
+            // Data is latched on the rising edge of LOAD: the next word starts fresh
+            numBits = 0;
+        }
+
+        lastClock = clock;
+        lastLoad = load;
+    }
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s [-w] [-c mosi,sck,load] [-f cpu_hz] [file]\n"
+        "  -w  Input is hex words clocked out while LOAD was high, one per line\n"
+        "  -c  Zero-indexed CSV columns of the MOSI, SCK and LOAD channels (default 0,1,2)\n"
+        "  -f  CPU frequency (CLOCK) for converting timer ticks to milliseconds (default 9600000)\n",
+        name
+    );
+}
+
+int main(int argc, char** argv)
+{
+    Decoder decoder = { .cpuFrequency = 9600000 };
+    int columns[3] = {0, 1, 2};
+    bool wordInput = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "wc:f:h")) != -1) {
+        switch (opt) {
+            case 'w':
+                wordInput = true;
+                break;
+
+            case 'c':
+                if (sscanf(optarg, "%d,%d,%d", &columns[0], &columns[1], &columns[2]) != 3) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+
+            case 'f':
+                decoder.cpuFrequency = atof(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    FILE* input = stdin;
+
+    if (optind < argc) {
+        input = fopen(argv[optind], "r");
+
+        if (input == NULL) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+
+    if (wordInput) {
+        decode_words(&decoder, input);
+    } else {
+        decode_samples(&decoder, input, columns);
+    }
+
+    fprintf(stderr, "%u records, %u errors\n", decoder.numRecords, decoder.numErrors);
+
+    return decoder.numErrors == 0 ? 0 : 1;
+}